@@ -0,0 +1,95 @@
+#include "Arena.h"
+
+#include "../macros.h"
+
+#include <sys/mman.h>
+
+// Totals over every arena, for printStats
+static std::atomic<size_t> totalAllocations{0};
+static std::atomic<size_t> totalBytes{0};
+static std::atomic<size_t> totalBlocks{0};
+static std::atomic<size_t> totalReserved{0};
+static std::atomic<size_t> hugePageBytes{0};
+static std::atomic<bool> hugePages{false};
+
+void *Arena::allocate(size_t size, size_t alignment) {
+  size_t start = (offset + alignment - 1) & ~(alignment - 1);
+  if (current == nullptr || start + size > capacity) {
+    if (size > ARENA_BLOCK_SIZE / 2) {
+      // Large allocations get their own block rather than wasting the rest of the current one
+      char *block = allocateBlock(size);
+      ++allocations;
+      bytes += size;
+      totalAllocations.fetch_add(1, std::memory_order_relaxed);
+      totalBytes.fetch_add(size, std::memory_order_relaxed);
+      return block;
+    }
+    current = allocateBlock(ARENA_BLOCK_SIZE);
+    capacity = ARENA_BLOCK_SIZE;
+    start = 0;
+  }
+  offset = start + size;
+  ++allocations;
+  bytes += size;
+  totalAllocations.fetch_add(1, std::memory_order_relaxed);
+  totalBytes.fetch_add(size, std::memory_order_relaxed);
+  return current + start;
+}
+
+char *Arena::allocateBlock(size_t size) {
+  size = (size + ARENA_BLOCK_SIZE - 1) / ARENA_BLOCK_SIZE * ARENA_BLOCK_SIZE;
+  char *block = (char *) aligned_alloc(ARENA_BLOCK_SIZE, size);
+  if (block == nullptr) {
+    std::cerr << "Failed to allocate " << size << " bytes for an arena." << std::endl;
+    exit(1);
+  }
+  #ifdef MADV_HUGEPAGE
+  if (hugePages.load(std::memory_order_relaxed) && madvise(block, size, MADV_HUGEPAGE) == 0)
+    hugePageBytes.fetch_add(size, std::memory_order_relaxed);
+  #endif
+  blocks.emplace_back(block, size);
+  totalBlocks.fetch_add(1, std::memory_order_relaxed);
+  totalReserved.fetch_add(size, std::memory_order_relaxed);
+  return block;
+}
+
+void Arena::adopt(Arena &other) {
+  blocks.insert(blocks.end(), other.blocks.begin(), other.blocks.end());
+  allocations += other.allocations;
+  bytes += other.bytes;
+  other.blocks.clear();
+  other.current = nullptr;
+  other.offset = 0;
+  other.capacity = 0;
+  other.allocations = 0;
+  other.bytes = 0;
+}
+
+void Arena::release() {
+  for (const std::pair<char *, size_t> &block : blocks) {
+    free(block.first);
+  }
+  blocks.clear();
+  current = nullptr;
+  offset = 0;
+  capacity = 0;
+}
+
+bool Arena::enableHugePages() {
+  #ifdef MADV_HUGEPAGE
+  hugePages = true;
+  return true;
+  #else
+  return false;
+  #endif
+}
+
+void Arena::printStats() {
+  if (totalBlocks == 0)
+    return;
+  std::cout << "Arena allocations: " << totalAllocations << " taking " << std::fixed << std::setprecision(2)
+            << totalBytes / 1048576.0 << " MB of " << totalReserved / 1048576.0 << " MB in " << totalBlocks << " blocks";
+  if (hugePages)
+    std::cout << " (" << hugePageBytes / 1048576.0 << " MB on huge pages)";
+  std::cout << std::endl;
+}
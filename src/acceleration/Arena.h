@@ -0,0 +1,105 @@
+#pragma once
+
+#include "../macros.h"
+
+// Size of the blocks arenas allocate, a transparent huge page on x86-64 Linux
+#define ARENA_BLOCK_SIZE (size_t(2) << 20)
+
+/**
+ * ArenaDelete - destroys an object allocated from an Arena without freeing it, the arena frees it in bulk.
+*/
+struct ArenaDelete {
+  template <typename T>
+  void operator()(T *ptr) const {
+    ptr->~T();
+  }
+};
+
+template <typename T>
+using ArenaPtr = std::unique_ptr<T, ArenaDelete>;
+
+/**
+ * class Arena
+ *
+ * Bump allocator for objects created one at a time but freed all together, like BVH build nodes and scene
+ * objects. Memory comes from blocks of ARENA_BLOCK_SIZE bytes (larger allocations get a block of their own)
+ * and is only returned when the arena is released or destroyed, which doesn't run destructors. Not thread
+ * safe, so every thread building objects uses its own arena and adopt merges them afterwards.
+ *
+ * private members:
+ *  blocks      - every block allocated, with its size
+ *  current     - block being bumped
+ *  offset      - bytes of current in use
+ *  capacity    - size of current
+ *  allocations - number of allocations made
+ *  bytes       - bytes handed out, not counting padding
+*/
+class Arena {
+public:
+  Arena() {};
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+  ~Arena() {
+    release();
+  }
+
+  /**
+   * allocate - size bytes aligned to alignment, which can't be more than ARENA_BLOCK_SIZE.
+  */
+  void *allocate(size_t size, size_t alignment);
+
+  /**
+   * create - constructs a T in the arena. Destructors are never run for it.
+  */
+  template <typename T, typename... Args>
+  T *create(Args&&... args) {
+    return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  }
+
+  /**
+   * make - constructs a T in the arena owned by an ArenaPtr, which runs its destructor.
+  */
+  template <typename T, typename... Args>
+  ArenaPtr<T> make(Args&&... args) {
+    return ArenaPtr<T>(create<T>(std::forward<Args>(args)...));
+  }
+
+  /**
+   * adopt - takes over the blocks of other, which is left empty, so they live as long as this arena.
+  */
+  void adopt(Arena &other);
+
+  /**
+   * release - frees every block at once.
+  */
+  void release();
+
+  size_t allocationCount() const {
+    return allocations;
+  }
+
+  size_t bytesUsed() const {
+    return bytes;
+  }
+
+  /**
+   * enableHugePages - asks for blocks allocated from now on to be backed by transparent huge pages.
+   * Returns false if the system doesn't support them.
+  */
+  static bool enableHugePages();
+
+  /**
+   * printStats - prints the allocations made by every arena so far.
+  */
+  static void printStats();
+
+private:
+  char *allocateBlock(size_t size);
+
+  std::vector<std::pair<char *, size_t>> blocks;
+  char *current = nullptr;
+  size_t offset = 0;
+  size_t capacity = 0;
+  size_t allocations = 0;
+  size_t bytes = 0;
+};
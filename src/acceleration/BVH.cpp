@@ -12,6 +12,7 @@
 
 BVH::~BVH() {
   free(nodes);
+  free(quantizedNodes);
 }
 
 void parallelFor(int start, int end, int maxThreads, std::function<void (int)> func) {
@@ -54,7 +55,7 @@ PartitionInfo BVH::threadPartitionTask(Node *node, int start, int end) {
   float bestCost = INF_D;
 
   for (int i = start; i < end; ++i) {
-    Vector3D centroid = objects[i]->centroid;
+    Vector3D centroid = (*objects)[i]->centroid;
     for (int axis = 0; axis < 3; ++axis) {
       float possiblePosition = centroid[axis];
       float cost = calculateSAH(node, axis, possiblePosition);
@@ -78,8 +79,8 @@ PartitionInfo BVH::findBestBucketSplit(Node *node) {
   Box extent;
   int end = node->start + node->numObjects;
   for(int i = node->start; i < end; ++i) {
-    extent.expand(objects[i]->centroid);
-    extent.shrink(objects[i]->centroid);
+    extent.expand((*objects)[i]->centroid);
+    extent.shrink((*objects)[i]->centroid);
   }
 
   const Vector3D &maxPoint = extent.maxPoint;
@@ -92,7 +93,7 @@ PartitionInfo BVH::findBestBucketSplit(Node *node) {
     int bucketCount[N_BUCKETS] = {0};
     float scale = N_BUCKETS / (maxPoint[axis] - minPoint[axis]);
     for(int i = node->start; i < end; ++i) {
-      std::unique_ptr<Object> &obj = objects[i];
+      ArenaPtr<Object> &obj = (*objects)[i];
       // Use min to fix case where centroid is the max extent
       int bucketIdx = std::min(N_BUCKETS - 1, static_cast<int>((obj->centroid[axis] - minPoint[axis]) * scale));
       buckets[bucketIdx].shrink(obj->aabbMin);
@@ -158,8 +159,9 @@ float Box::surfaceArea() {
   return 2 * (extent.x * extent.y + extent.y * extent.z + extent.x * extent.z);
 }
 
-BVH::BVH(std::vector<std::unique_ptr<Object>> &objects, int maxThreads)
-  : objects(objects), maxThreads(maxThreads), progress(70, objects.size(), std::max(1024.0, objects.size() * 0.01)) {
+BVH::BVH(std::vector<ArenaPtr<Object>> &objects, int maxThreads)
+  : numNodes(0), numObjects(objects.size()), maxThreads(maxThreads),
+    progress(70, objects.size(), std::max(1024.0, objects.size() * 0.01)) {
   Profiler p(Funcs::BVHConstruction);
   
   if (objects.size() == 0) {
@@ -168,26 +170,62 @@ BVH::BVH(std::vector<std::unique_ptr<Object>> &objects, int maxThreads)
     return;
   }
 
-  Node *root = new Node();
+  this->objects = &objects;
+  Node *root = buildNodes.create<Node>();
   root->start = 0;
   root->numObjects = objects.size();
   updateNodeBounds(root);
-  int numNodes = partition(root);
-  // Allocate array of 32 byte blocks and align array to 32 byte address for cache performance
-  nodes = (FlattenedNode *) aligned_alloc(32, 32 * numNodes);
-  int idx = 0;
-  flatten(root, idx);
+  // One more node pads the root so sibling pairs start on even indices
+  numNodes = partition(root) + 1;
+  nodes = allocateNodes(numNodes);
+  nodes[1] = FlattenedNode();
+  int idx = 2;
+  flatten(root, 0, idx);
+  buildNodes.release();
+  packPrimitives();
+  // Leaves read the packed copies from here on, and objects may not outlive the tree
+  this->objects = nullptr;
   std::cout << "BVH created with " << numNodes << " nodes on " << objects.size() << " objects." << std::endl;
   this->maxThreads += 0;
 }
 
+BVH::BVH(std::vector<ArenaPtr<Object>> &objects, std::vector<std::unique_ptr<BVH>> &subtrees)
+  : numNodes(0), numObjects(objects.size()), maxThreads(1), progress(70, subtrees.size(), 1) {
+  Profiler p(Funcs::BVHConstruction);
+
+  std::vector<BVH *> roots;
+  size_t numLines = 0;
+  for (std::unique_ptr<BVH> &subtree : subtrees) {
+    if (subtree->nodes != nullptr) {
+      roots.push_back(subtree.get());
+      // top level needs one inner node for every subtree after the first, and drops the padding of each
+      numNodes += subtree->numNodes;
+      numLines += subtree->arena.size();
+    }
+    progress.increment();
+  }
+
+  if (roots.empty()) {
+    nodes = nullptr;
+    std::cout << "No triangles or spheres in scene. BVH not created." << std::endl;
+    return;
+  }
+
+  nodes = allocateNodes(numNodes);
+  nodes[1] = FlattenedNode();
+  int idx = 2;
+  arena.reserve(numLines);
+  splice(roots.begin(), roots.end(), 0, idx);
+  std::cout << "BVH spliced with " << numNodes << " nodes on " << objects.size() << " objects from " << roots.size() << " subtrees." << std::endl;
+}
+
 void BVH::updateNodeBounds(Node *node) {
   node->aabbMin = Vector3D(INF_D, INF_D, INF_D);
   node->aabbMax = Vector3D(-INF_D, -INF_D, -INF_D);
   int end = node->start + node->numObjects;
   for (int i = node->start; i < end; ++i) {
-    Vector3D aabbObjMin = objects[i]->aabbMin;
-    Vector3D aabbObjMax = objects[i]->aabbMax;
+    Vector3D aabbObjMin = (*objects)[i]->aabbMin;
+    Vector3D aabbObjMax = (*objects)[i]->aabbMax;
 
     node->aabbMin.x = std::min(node->aabbMin.x, aabbObjMin.x);
     node->aabbMin.y = std::min(node->aabbMin.y, aabbObjMin.y);
@@ -208,7 +246,7 @@ float BVH::calculateSAH(Node *node, int axis, float position) {
 
   int end = node->start + node->numObjects;
   for(int i = node->start; i < end; ++i) {
-    std::unique_ptr<Object> &obj = objects[i];
+    ArenaPtr<Object> &obj = (*objects)[i];
     if (obj->centroid[axis] < position) {
       leftBox.shrink(obj->aabbMin);
       leftBox.expand(obj->aabbMax);
@@ -232,7 +270,7 @@ int BVH::partition(Node *node) {
   // Base case: allow a max of 4 objects for a node before becoming a leaf
   if (node->numObjects <= MIN_LEAF_SIZE) {
     progress.increment(node->numObjects);
-    return 1;
+    return makeLeaf(node);
   }
   
   int bestAxis = -1;
@@ -247,7 +285,7 @@ int BVH::partition(Node *node) {
   float parentCost = parentBox.surfaceArea() * node->numObjects;
   if (info.bestCost >= parentCost) {
     progress.increment(node->numObjects);
-    return 1;
+    return makeLeaf(node);
   }
 
   int axis = info.bestAxis;
@@ -255,20 +293,20 @@ int BVH::partition(Node *node) {
   int i = node->start;
   int j = i + node->numObjects;
   
-  auto middle = std::partition(objects.begin() + i, objects.begin() + j,
-  [axis, splitPosition](const std::unique_ptr<Object>& em) {
+  auto middle = std::partition(objects->begin() + i, objects->begin() + j,
+  [axis, splitPosition](const ArenaPtr<Object>& em) {
     return em->centroid[axis] < splitPosition;
   });
 
   // abort split if one of the sides is empty
-  int leftNumObjects = std::distance(objects.begin() + i, middle);
+  int leftNumObjects = std::distance(objects->begin() + i, middle);
   if (leftNumObjects == 0 || leftNumObjects == node->numObjects) {
     progress.increment(node->numObjects);
-    return 1;
+    return makeLeaf(node);
   }
   // create child nodes
-  node->left = new Node();
-  node->right = new Node();
+  node->left = buildNodes.create<Node>();
+  node->right = buildNodes.create<Node>();
   node->left->start = node->start;
   node->left->numObjects = leftNumObjects;
   node->right->start = i + leftNumObjects;
@@ -280,10 +318,41 @@ int BVH::partition(Node *node) {
   return partition(node->left) + partition(node->right) + 1;
 }
 
+int BVH::makeLeaf(Node *node) {
+  auto begin = objects->begin() + node->start;
+  auto end = begin + node->numObjects;
+  std::stable_sort(begin, end, [](const ArenaPtr<Object> &a, const ArenaPtr<Object> &b) {
+    return PrimitiveTypes::typeOf(*a) < PrimitiveTypes::typeOf(*b);
+  });
+
+  // Scene::addObject rejects unregistered types and meshes only hold triangles, so every object has a tag
+  node->type = PrimitiveTypes::typeOf(**begin);
+  auto split = std::find_if(begin, end, [node](const ArenaPtr<Object> &obj) {
+    return PrimitiveTypes::typeOf(*obj) != node->type;
+  });
+  if (split == end)
+    return 1;
+
+  // Leaves hold one type, so mixed leaves become a node over the first type and the rest
+  node->left = buildNodes.create<Node>();
+  node->right = buildNodes.create<Node>();
+  node->left->start = node->start;
+  node->left->numObjects = std::distance(begin, split);
+  node->left->type = node->type;
+  node->right->start = node->start + node->left->numObjects;
+  node->right->numObjects = node->numObjects - node->left->numObjects;
+  node->numObjects = 0;
+  updateNodeBounds(node->left);
+  updateNodeBounds(node->right);
+  return makeLeaf(node->right) + 2;
+}
+
 IntersectionInfo BVH::findClosestObject(const Vector3D& origin, const Vector3D& direction) {
   #ifdef PROFILE_INTERSECT
   Profiler p(Funcs::BVHIntersectClosest);
   #endif
+  if (quantizedNodes != nullptr)
+    return findClosestObjectQuantized(origin, direction);
   if (nodes == nullptr)
     return { INF_D, {}, {}, nullptr };
   // Use vector as the underlying container
@@ -291,12 +360,15 @@ IntersectionInfo BVH::findClosestObject(const Vector3D& origin, const Vector3D&
   int to_visit[STACK_SIZE];
   float distances[STACK_SIZE];
   Vector3D invDirection = 1.0f / direction;
+  Vector3D unitDirection = normalized(direction);
   to_visit[0] = 0;
   distances[0] = intersectAABB(origin, invDirection, nodes[0].aabbMin, nodes[0].aabbMax);
   int stackIdx = 0;
 
   float minDistance = INF_D;
-  IntersectionInfo closestInfo{ INF_D, {}, {}, nullptr };
+  ClosestHit closest;
+  NodeFetchCounter fetches;
+  fetches.fetch(nodes);
 
   while (stackIdx >= 0) {
     float dist = distances[stackIdx];
@@ -304,19 +376,14 @@ IntersectionInfo BVH::findClosestObject(const Vector3D& origin, const Vector3D&
     FlattenedNode &subtree = nodes[nodeIdx];
     if (dist < minDistance) {
       if (subtree.isLeaf()) {
-        int end = subtree.start + subtree.numObjects;
-        for (int i = subtree.start; i < end; ++i) {
-          IntersectionInfo info = objects[i]->intersect(origin, direction);
-          if (info.t < minDistance) {
-            minDistance = info.t;
-            closestInfo = info;
-          }
-        }
+        intersectLeaf(subtree, origin, unitDirection, closest);
+        minDistance = closest.hit.t;
       } else {
-        int leftIdx = nodeIdx + 1;
-        int rightIdx = subtree.right;
+        int leftIdx = subtree.left;
+        int rightIdx = leftIdx + 1;
         FlattenedNode &left = nodes[leftIdx];
         FlattenedNode &right = nodes[rightIdx];
+        fetches.fetch(&left);
         float leftDistance = intersectAABB(origin, invDirection, left.aabbMin, left.aabbMax);
         float rightDistance = intersectAABB(origin, invDirection, right.aabbMin, right.aabbMax);
         if (rightDistance < leftDistance) {
@@ -336,46 +403,47 @@ IntersectionInfo BVH::findClosestObject(const Vector3D& origin, const Vector3D&
     --stackIdx;
   }
 
-  return closestInfo;
+  return resolve(closest, origin, unitDirection);
 }
 
-bool BVH::findAnyObject(const Vector3D& origin, const Vector3D& direction) {
+bool BVH::findAnyObject(const Vector3D& origin, const Vector3D& direction, float maxT) {
   #ifdef PROFILE_INTERSECT
   Profiler p(Funcs::BVHIntersectAny);
   #endif
+  if (quantizedNodes != nullptr)
+    return findAnyObjectQuantized(origin, direction, maxT);
   if (nodes == nullptr)
     return false;
   // Use array which is lighter and faster than vector/stack
   // to_visit stores next node index to visit
   int to_visit[STACK_SIZE];
   Vector3D invDirection = 1.0f / direction;
+  Vector3D unitDirection = normalized(direction);
   to_visit[0] = 0;
   int stackIdx = 0;
+  NodeFetchCounter fetches;
+  fetches.fetch(nodes);
 
   while (stackIdx >= 0) {
     int nodeIdx = to_visit[stackIdx];
     FlattenedNode &subtree = nodes[nodeIdx];
     if (subtree.isLeaf()) {
-      int end = subtree.start + subtree.numObjects;
-      for (int i = subtree.start; i < end; ++i) {
-        IntersectionInfo info = objects[i]->intersect(origin, direction);
-        if (info.obj != nullptr) {
-          return true;
-        }
-      }
+      if (leafOccludes(subtree, origin, unitDirection, maxT))
+        return true;
     } else {
-      int leftIdx = nodeIdx + 1;
-      int rightIdx = subtree.right;
+      int leftIdx = subtree.left;
+      int rightIdx = leftIdx + 1;
       FlattenedNode &left = nodes[leftIdx];
       FlattenedNode &right = nodes[rightIdx];
+      fetches.fetch(&left);
       float leftDistance = intersectAABB(origin, invDirection, left.aabbMin, left.aabbMax);
       float rightDistance = intersectAABB(origin, invDirection, right.aabbMin, right.aabbMax);
       if (rightDistance < leftDistance) {
         std::swap(leftIdx, rightIdx);
         std::swap(leftDistance, rightDistance);
       }
-      if (leftDistance != INF_D) {
-        if (rightDistance != INF_D) {
+      if (leftDistance < maxT) {
+        if (rightDistance < maxT) {
           to_visit[stackIdx++] = rightIdx;
         }
         to_visit[stackIdx++] = leftIdx;
@@ -387,6 +455,264 @@ bool BVH::findAnyObject(const Vector3D& origin, const Vector3D& direction) {
   return false;
 }
 
+void BVH::packPrimitives() {
+  size_t numLines = 0;
+  for (int nodeIdx = 0; nodeIdx < numNodes; ++nodeIdx) {
+    const FlattenedNode &leaf = nodes[nodeIdx];
+    if (leaf.isLeaf()) {
+      PrimitiveTypes::visit(leaf.type, [&](auto tag) {
+        numLines += PrimitiveArena::linesFor<typename decltype(tag)::type>(leaf.numObjects);
+      });
+    }
+  }
+
+  // Nodes are in depth first order, so leaves that are close in the tree end up close in the arena
+  arena.reserve(numLines);
+  for (int nodeIdx = 0; nodeIdx < numNodes; ++nodeIdx) {
+    FlattenedNode &leaf = nodes[nodeIdx];
+    if (!leaf.isLeaf())
+      continue;
+    PrimitiveTypes::visit(leaf.type, [&](auto tag) {
+      leaf.start = arena.append<typename decltype(tag)::type>(objects->begin() + leaf.start, leaf.numObjects);
+    });
+  }
+}
+
+template <typename Leaf>
+void BVH::intersectLeaf(const Leaf &leaf, const Vector3D& origin, const Vector3D& direction, ClosestHit &closest) const {
+  PrimitiveTypes::visit(leaf.type, [&](auto tag) {
+    using T = typename decltype(tag)::type;
+    constexpr int stride = PrimitiveArena::packLines<T>();
+    int endLine = leaf.start + PrimitiveArena::linesFor<T>(leaf.numObjects);
+    for (int line = leaf.start; line < endLine; line += stride) {
+      int lane = PrimitiveKernel<T>::intersect(arena.pack<T>(line), origin, direction, closest.hit.t, closest.hit);
+      if (lane >= 0) {
+        closest.line = line;
+        closest.lane = lane;
+        closest.type = leaf.type;
+      }
+    }
+  });
+}
+
+IntersectionInfo BVH::resolve(const ClosestHit &closest, const Vector3D& origin, const Vector3D& direction) const {
+  IntersectionInfo info{ INF_D, {}, {}, nullptr };
+  if (closest.line < 0)
+    return info;
+  PrimitiveTypes::visit(closest.type, [&](auto tag) {
+    using T = typename decltype(tag)::type;
+    info = PrimitiveKernel<T>::info(*arena.object<T>(closest.line, closest.lane), origin, direction, closest.hit);
+  });
+  return info;
+}
+
+template <typename Leaf>
+bool BVH::leafOccludes(const Leaf &leaf, const Vector3D& origin, const Vector3D& direction, float maxT) const {
+  bool occluded = false;
+  PrimitiveTypes::visit(leaf.type, [&](auto tag) {
+    using T = typename decltype(tag)::type;
+    constexpr int stride = PrimitiveArena::packLines<T>();
+    PrimitiveHit hit;
+    int endLine = leaf.start + PrimitiveArena::linesFor<T>(leaf.numObjects);
+    for (int line = leaf.start; line < endLine && !occluded; line += stride) {
+      occluded = PrimitiveKernel<T>::intersect(arena.pack<T>(line), origin, direction, maxT, hit) >= 0;
+    }
+  });
+  return occluded;
+}
+
+// Smallest and largest product of a value in [a0, a1] and a value in [b0, b1]
+static inline void intervalProduct(float a0, float a1, float b0, float b1, float &lo, float &hi) {
+  float p0 = a0 * b0;
+  float p1 = a0 * b1;
+  float p2 = a1 * b0;
+  float p3 = a1 * b1;
+  lo = std::min(std::min(p0, p1), std::min(p2, p3));
+  hi = std::max(std::max(p0, p1), std::max(p2, p3));
+}
+
+/**
+ * PacketBounds struct
+ *
+ * Intervals around the origins and inverse directions of every ray of a packet. When the directions share
+ * signs, the near and far planes of a box are the same for every ray, so interval arithmetic bounds where
+ * any ray of the packet can enter and leave the box.
+*/
+struct PacketBounds {
+  float originMin[3];
+  float originMax[3];
+  float invMin[3];
+  float invMax[3];
+  bool negative[3];
+
+  /**
+   * misses - whether no ray can hit the box before maxT.
+  */
+  bool misses(const Vector3D &aabbMin, const Vector3D &aabbMax, float maxT) const {
+    float nearLo = -INF_D;
+    float farHi = INF_D;
+    for (int axis = 0; axis < 3; ++axis) {
+      float nearPlane = negative[axis] ? aabbMax[axis] : aabbMin[axis];
+      float farPlane = negative[axis] ? aabbMin[axis] : aabbMax[axis];
+      float lo, hi;
+      intervalProduct(nearPlane - originMax[axis], nearPlane - originMin[axis], invMin[axis], invMax[axis], lo, hi);
+      nearLo = std::max(nearLo, lo);
+      intervalProduct(farPlane - originMax[axis], farPlane - originMin[axis], invMin[axis], invMax[axis], lo, hi);
+      farHi = std::min(farHi, hi);
+    }
+    return nearLo > farHi || farHi <= 0 || nearLo >= maxT;
+  }
+};
+
+// Entry distance of every lane's ray into the box, or INF_D for lanes that miss it or already hit something closer
+template <int N>
+static inline void intersectAABBs(
+  const float *ox, const float *oy, const float *oz,
+  const float *invX, const float *invY, const float *invZ,
+  const float *tMax, const Vector3D &aabbMin, const Vector3D &aabbMax, float *tEntry)
+{
+  for (int i = 0; i < N; ++i) {
+    float tx0 = (aabbMin.x - ox[i]) * invX[i];
+    float tx1 = (aabbMax.x - ox[i]) * invX[i];
+    float ty0 = (aabbMin.y - oy[i]) * invY[i];
+    float ty1 = (aabbMax.y - oy[i]) * invY[i];
+    float tz0 = (aabbMin.z - oz[i]) * invZ[i];
+    float tz1 = (aabbMax.z - oz[i]) * invZ[i];
+    float tmin = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::min(tz0, tz1));
+    float tmax = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::max(tz0, tz1));
+    tEntry[i] = (tmax >= tmin && tmax > 0 && tmin < tMax[i]) ? tmin : INF_D;
+  }
+}
+
+template <int N>
+void BVH::findClosestObjects(const RayPacket<N> &packet, IntersectionInfo *infos) {
+  #ifdef PROFILE_INTERSECT
+  Profiler p(Funcs::BVHIntersectClosest);
+  #endif
+  for (int i = 0; i < packet.size; ++i) {
+    infos[i] = { INF_D, {}, {}, nullptr };
+  }
+  if (quantizedNodes != nullptr) {
+    for (int i = 0; i < packet.size; ++i) {
+      infos[i] = findClosestObjectQuantized(Vector3D(packet.ox[i], packet.oy[i], packet.oz[i]), Vector3D(packet.dx[i], packet.dy[i], packet.dz[i]));
+    }
+    return;
+  }
+  if (nodes == nullptr || packet.size == 0)
+    return;
+
+  // Unused lanes copy the first ray but can never hit anything
+  float ox[N], oy[N], oz[N], invX[N], invY[N], invZ[N], tMax[N];
+  for (int i = 0; i < N; ++i) {
+    int lane = (i < packet.size) ? i : 0;
+    ox[i] = packet.ox[lane];
+    oy[i] = packet.oy[lane];
+    oz[i] = packet.oz[lane];
+    invX[i] = 1.0f / packet.dx[lane];
+    invY[i] = 1.0f / packet.dy[lane];
+    invZ[i] = 1.0f / packet.dz[lane];
+    tMax[i] = (i < packet.size) ? INF_D : -INF_D;
+  }
+
+  PacketBounds bounds;
+  const float *origins[3] = { ox, oy, oz };
+  const float *invs[3] = { invX, invY, invZ };
+  bool coherent = true;
+  for (int axis = 0; axis < 3 && coherent; ++axis) {
+    bounds.originMin[axis] = bounds.invMin[axis] = INF_D;
+    bounds.originMax[axis] = bounds.invMax[axis] = -INF_D;
+    bounds.negative[axis] = std::signbit(invs[axis][0]);
+    for (int i = 0; i < packet.size; ++i) {
+      float inv = invs[axis][i];
+      coherent &= std::isfinite(inv) && std::signbit(inv) == bounds.negative[axis];
+      bounds.originMin[axis] = std::min(bounds.originMin[axis], origins[axis][i]);
+      bounds.originMax[axis] = std::max(bounds.originMax[axis], origins[axis][i]);
+      bounds.invMin[axis] = std::min(bounds.invMin[axis], inv);
+      bounds.invMax[axis] = std::max(bounds.invMax[axis], inv);
+    }
+  }
+  if (!coherent) {
+    for (int i = 0; i < packet.size; ++i) {
+      infos[i] = findClosestObject(Vector3D(packet.ox[i], packet.oy[i], packet.oz[i]), Vector3D(packet.dx[i], packet.dy[i], packet.dz[i]));
+    }
+    return;
+  }
+
+  ClosestHit closest[N];
+  Vector3D unitDirections[N];
+  for (int i = 0; i < packet.size; ++i) {
+    unitDirections[i] = normalized(Vector3D(packet.dx[i], packet.dy[i], packet.dz[i]));
+  }
+
+  int to_visit[STACK_SIZE];
+  float distances[STACK_SIZE];
+  float tEntry[N];
+  float maxT = INF_D;
+  NodeFetchCounter fetches;
+  fetches.fetch(nodes);
+  to_visit[0] = 0;
+  distances[0] = -INF_D;
+  int stackIdx = 0;
+
+  while (stackIdx >= 0) {
+    float dist = distances[stackIdx];
+    int nodeIdx = to_visit[stackIdx];
+    --stackIdx;
+    // Every ray has already hit something closer than the nearest point any of them enters the node at
+    if (dist >= maxT)
+      continue;
+
+    FlattenedNode &subtree = nodes[nodeIdx];
+    if (subtree.isLeaf()) {
+      intersectAABBs<N>(ox, oy, oz, invX, invY, invZ, tMax, subtree.aabbMin, subtree.aabbMax, tEntry);
+      for (int lane = 0; lane < packet.size; ++lane) {
+        if (tEntry[lane] == INF_D)
+          continue;
+        Vector3D origin(ox[lane], oy[lane], oz[lane]);
+        intersectLeaf(subtree, origin, unitDirections[lane], closest[lane]);
+        tMax[lane] = closest[lane].hit.t;
+      }
+      maxT = -INF_D;
+      for (int i = 0; i < N; ++i) {
+        maxT = std::max(maxT, tMax[i]);
+      }
+      continue;
+    }
+
+    int childIdx[2] = { subtree.left, subtree.left + 1 };
+    float childDistance[2];
+    fetches.fetch(&nodes[childIdx[0]]);
+    for (int c = 0; c < 2; ++c) {
+      FlattenedNode &child = nodes[childIdx[c]];
+      childDistance[c] = INF_D;
+      if (bounds.misses(child.aabbMin, child.aabbMax, maxT))
+        continue;
+      intersectAABBs<N>(ox, oy, oz, invX, invY, invZ, tMax, child.aabbMin, child.aabbMax, tEntry);
+      for (int i = 0; i < N; ++i) {
+        childDistance[c] = std::min(childDistance[c], tEntry[i]);
+      }
+    }
+    // Push the farther child first so the nearer one is visited next
+    int nearChild = (childDistance[1] < childDistance[0]) ? 1 : 0;
+    int farChild = 1 - nearChild;
+    if (childDistance[farChild] != INF_D) {
+      to_visit[++stackIdx] = childIdx[farChild];
+      distances[stackIdx] = childDistance[farChild];
+    }
+    if (childDistance[nearChild] != INF_D) {
+      to_visit[++stackIdx] = childIdx[nearChild];
+      distances[stackIdx] = childDistance[nearChild];
+    }
+  }
+
+  for (int lane = 0; lane < packet.size; ++lane) {
+    infos[lane] = resolve(closest[lane], Vector3D(ox[lane], oy[lane], oz[lane]), unitDirections[lane]);
+  }
+}
+
+template void BVH::findClosestObjects<4>(const RayPacket<4> &packet, IntersectionInfo *infos);
+template void BVH::findClosestObjects<8>(const RayPacket<8> &packet, IntersectionInfo *infos);
+
 float BVH::intersectAABB(const Vector3D& origin, const Vector3D& invDirection, const Vector3D& aabbMin, const Vector3D& aabbMax) {
   // Profiler p(Funcs::BVHIntersectAABB);
 
@@ -408,21 +734,376 @@ float BVH::intersectAABB(const Vector3D& origin, const Vector3D& invDirection, c
   return INF_D;
 }
 
-void BVH::flatten(Node *node, int &idx) {
-  // i is index of current node in the array
-  int i = idx;
-  ++idx;
+void BVH::flatten(Node *node, int i, int &idx) {
   FlattenedNode &flatNode = nodes[i];
   flatNode.aabbMin = node->aabbMin;
   flatNode.aabbMax = node->aabbMax;
   flatNode.numObjects = node->numObjects;
+  flatNode.type = node->type;
   if (node->isLeaf()) {
     flatNode.start = node->start;
-    delete node;
     return;
   }
-  flatten(node->left, idx);
-  flatNode.right = idx;
-  flatten(node->right, idx);
-  delete node;
+  int left = idx;
+  idx += 2;
+  flatNode.left = left;
+  flatten(node->left, left, idx);
+  flatten(node->right, left + 1, idx);
+}
+
+BVH::FlattenedNode *BVH::allocateNodes(int count) {
+  size_t bytes = (sizeof(FlattenedNode) * count + 4095) / 4096 * 4096;
+  return (FlattenedNode *) aligned_alloc(4096, bytes);
+}
+
+void BVH::layout(BVHLayout layout) {
+  if (nodes == nullptr || nodes[0].isLeaf())
+    return;
+
+  // Pairs are named by the index of their first node, the root and its padding being pair 0
+  auto forEachChild = [this](int pair, auto func) {
+    for (int i = pair; i < pair + 2; ++i) {
+      if (i != 1 && !nodes[i].isLeaf())
+        func(nodes[i].left);
+    }
+  };
+  std::vector<int> order;
+  order.reserve(numNodes / 2);
+
+  if (layout == BVHLayout::DepthFirst || layout == BVHLayout::SubtreeSize) {
+    // Children of a pair have higher indices than the pair, so sizes can be summed from the end
+    std::vector<int> size(numNodes / 2, 1);
+    for (int pair = numNodes - 2; pair >= 0; pair -= 2) {
+      forEachChild(pair, [&](int child) { size[pair / 2] += size[child / 2]; });
+    }
+    std::vector<int> stack = { 0 };
+    while (!stack.empty()) {
+      int pair = stack.back();
+      stack.pop_back();
+      order.push_back(pair);
+      int children[2];
+      int numChildren = 0;
+      forEachChild(pair, [&](int child) { children[numChildren++] = child; });
+      if (layout == BVHLayout::SubtreeSize && numChildren == 2 && size[children[1] / 2] > size[children[0] / 2])
+        std::swap(children[0], children[1]);
+      for (int c = numChildren - 1; c >= 0; --c) {
+        stack.push_back(children[c]);
+      }
+    }
+  } else if (layout == BVHLayout::VanEmdeBoas) {
+    std::vector<int> height(numNodes / 2, 1);
+    for (int pair = numNodes - 2; pair >= 0; pair -= 2) {
+      forEachChild(pair, [&](int child) { height[pair / 2] = std::max(height[pair / 2], height[child / 2] + 1); });
+    }
+    // Lays out the levels levels of the tree under pair, top half first
+    std::function<void (int, int)> vanEmdeBoas = [&](int pair, int levels) {
+      if (levels == 1) {
+        order.push_back(pair);
+        return;
+      }
+      int top = levels / 2;
+      vanEmdeBoas(pair, top);
+      std::vector<int> frontier = { pair };
+      for (int level = 0; level < top; ++level) {
+        std::vector<int> next;
+        for (int p : frontier) {
+          forEachChild(p, [&](int child) { next.push_back(child); });
+        }
+        frontier.swap(next);
+      }
+      for (int p : frontier) {
+        vanEmdeBoas(p, levels - top);
+      }
+    };
+    vanEmdeBoas(0, height[0]);
+  } else {
+    size_t pairsPerTreelet = (layout == BVHLayout::LineTreelets) ? 2 : 4096 / (2 * sizeof(FlattenedNode));
+    auto area = [this](int pair) {
+      Box box(nodes[pair].aabbMin, nodes[pair].aabbMax);
+      if (pair != 0) {
+        box.shrink(nodes[pair + 1].aabbMin);
+        box.expand(nodes[pair + 1].aabbMax);
+      }
+      return box.surfaceArea();
+    };
+    // Every treelet is filled, taking the next root once its own subtree runs out, so treelets stay aligned
+    std::deque<int> roots = { 0 };
+    std::priority_queue<std::pair<float, int>> candidates;
+    while (!roots.empty() || !candidates.empty()) {
+      for (size_t taken = 0; taken < pairsPerTreelet; ++taken) {
+        if (candidates.empty()) {
+          if (roots.empty())
+            break;
+          candidates.emplace(0.0f, roots.front());
+          roots.pop_front();
+        }
+        int pair = candidates.top().second;
+        candidates.pop();
+        order.push_back(pair);
+        forEachChild(pair, [&](int child) { candidates.emplace(area(child), child); });
+      }
+      for (; !candidates.empty(); candidates.pop()) {
+        roots.push_back(candidates.top().second);
+      }
+    }
+  }
+
+  std::vector<int> index(numNodes);
+  for (size_t i = 0; i < order.size(); ++i) {
+    index[order[i]] = 2 * i;
+    index[order[i] + 1] = 2 * i + 1;
+  }
+  FlattenedNode *laidOut = allocateNodes(numNodes);
+  for (int i = 0; i < numNodes; ++i) {
+    FlattenedNode &flatNode = laidOut[index[i]];
+    flatNode = nodes[i];
+    if (i != 1 && !flatNode.isLeaf())
+      flatNode.left = index[flatNode.left];
+  }
+  free(nodes);
+  nodes = laidOut;
+}
+
+// Smallest exponent whose 255 steps from frameMin reach frameMax
+static int quantizationExponent(float frameMin, float frameMax) {
+  int exponent = -126;
+  float extent = frameMax - frameMin;
+  if (extent > 0)
+    exponent = std::max(-126, std::min(127, static_cast<int>(std::ceil(std::log2(extent / 255)))));
+  while (exponent < 127 && frameMin + 255 * std::ldexp(1.0f, exponent) < frameMax)
+    ++exponent;
+  while (exponent > -126 && frameMin + 255 * std::ldexp(1.0f, exponent - 1) >= frameMax)
+    --exponent;
+  return exponent;
+}
+
+// Largest number of steps from frameMin that doesn't pass value
+static uint8_t quantizeDown(float value, float frameMin, float step) {
+  int q = static_cast<int>(std::min(255.0f, std::max(0.0f, std::floor((value - frameMin) / step))));
+  while (q > 0 && frameMin + q * step > value)
+    --q;
+  return q;
+}
+
+// Smallest number of steps from frameMin that reaches value
+static uint8_t quantizeUp(float value, float frameMin, float step) {
+  int q = static_cast<int>(std::min(255.0f, std::max(0.0f, std::ceil((value - frameMin) / step))));
+  while (q < 255 && frameMin + q * step < value)
+    ++q;
+  return q;
+}
+
+void BVH::quantize() {
+  if (nodes == nullptr || nodes[0].isLeaf())
+    return;
+
+  // Skipping the padding, every inner node gets the next QuantizedNode
+  std::vector<int> index(numNodes, -1);
+  int numInner = 0;
+  for (int i = 0; i < numNodes; ++i) {
+    if (i != 1 && !nodes[i].isLeaf())
+      index[i] = numInner++;
+  }
+  quantizedNodes = (QuantizedNode *) aligned_alloc(32, sizeof(QuantizedNode) * numInner);
+  rootBox = Box(nodes[0].aabbMin, nodes[0].aabbMax);
+  quantizeNode(0, rootBox.minPoint, rootBox.maxPoint, index);
+  std::cout << "BVH quantized from " << numNodes * sizeof(FlattenedNode) / 1024 << " KB to "
+            << numInner * sizeof(QuantizedNode) / 1024 << " KB of nodes." << std::endl;
+  free(nodes);
+  nodes = nullptr;
+}
+
+void BVH::quantizeNode(int nodeIdx, const Vector3D &frameMin, const Vector3D &frameMax, const std::vector<int> &index) {
+  QuantizedNode &node = quantizedNodes[index[nodeIdx]];
+  float step[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    node.exponent[axis] = quantizationExponent(frameMin[axis], frameMax[axis]);
+    step[axis] = QuantizedNode::step(node.exponent[axis]);
+  }
+  node.unused = 0;
+
+  int childIdx[2] = { nodes[nodeIdx].left, nodes[nodeIdx].left + 1 };
+  for (int c = 0; c < 2; ++c) {
+    const FlattenedNode &child = nodes[childIdx[c]];
+    for (int axis = 0; axis < 3; ++axis) {
+      node.lo[c][axis] = quantizeDown(child.aabbMin[axis], frameMin[axis], step[axis]);
+      node.hi[c][axis] = quantizeUp(child.aabbMax[axis], frameMin[axis], step[axis]);
+    }
+    node.child[c].numObjects = child.numObjects;
+    node.child[c].type = child.type;
+    if (child.isLeaf()) {
+      node.child[c].start = child.start;
+    } else {
+      // The child's box is decoded the same way during traversal, so it is the frame of the child's children
+      Vector3D childMin, childMax;
+      node.decode(c, frameMin, childMin, childMax);
+      node.child[c].index = index[childIdx[c]];
+      quantizeNode(childIdx[c], childMin, childMax, index);
+    }
+  }
+}
+
+IntersectionInfo BVH::findClosestObjectQuantized(const Vector3D& origin, const Vector3D& direction) {
+  QuantizedChild to_visit[STACK_SIZE];
+  float distances[STACK_SIZE];
+  // min corner of the box of every inner node on the stack
+  Vector3D frames[STACK_SIZE];
+  Vector3D invDirection = 1.0f / direction;
+  Vector3D unitDirection = normalized(direction);
+  to_visit[0].index = 0;
+  to_visit[0].numObjects = 0;
+  distances[0] = intersectAABB(origin, invDirection, rootBox.minPoint, rootBox.maxPoint);
+  frames[0] = rootBox.minPoint;
+  int stackIdx = 0;
+
+  float minDistance = INF_D;
+  ClosestHit closest;
+  NodeFetchCounter fetches;
+
+  while (stackIdx >= 0) {
+    float dist = distances[stackIdx];
+    QuantizedChild subtree = to_visit[stackIdx];
+    Vector3D frame = frames[stackIdx];
+    --stackIdx;
+    if (dist >= minDistance)
+      continue;
+    if (subtree.isLeaf()) {
+      intersectLeaf(subtree, origin, unitDirection, closest);
+      minDistance = closest.hit.t;
+      continue;
+    }
+
+    const QuantizedNode &node = quantizedNodes[subtree.index];
+    fetches.fetch(&node);
+    Vector3D childMin[2], childMax[2];
+    float childDistance[2];
+    for (int c = 0; c < 2; ++c) {
+      node.decode(c, frame, childMin[c], childMax[c]);
+      childDistance[c] = intersectAABB(origin, invDirection, childMin[c], childMax[c]);
+    }
+    // Push the farther child first so the nearer one is visited next
+    int nearChild = (childDistance[1] < childDistance[0]) ? 1 : 0;
+    int farChild = 1 - nearChild;
+    if (childDistance[farChild] != INF_D) {
+      to_visit[++stackIdx] = node.child[farChild];
+      distances[stackIdx] = childDistance[farChild];
+      frames[stackIdx] = childMin[farChild];
+    }
+    if (childDistance[nearChild] != INF_D) {
+      to_visit[++stackIdx] = node.child[nearChild];
+      distances[stackIdx] = childDistance[nearChild];
+      frames[stackIdx] = childMin[nearChild];
+    }
+  }
+
+  return resolve(closest, origin, unitDirection);
+}
+
+bool BVH::findAnyObjectQuantized(const Vector3D& origin, const Vector3D& direction, float maxT) {
+  QuantizedChild to_visit[STACK_SIZE];
+  // min corner of the box of every inner node on the stack
+  Vector3D frames[STACK_SIZE];
+  Vector3D invDirection = 1.0f / direction;
+  Vector3D unitDirection = normalized(direction);
+  if (intersectAABB(origin, invDirection, rootBox.minPoint, rootBox.maxPoint) >= maxT)
+    return false;
+  to_visit[0].index = 0;
+  to_visit[0].numObjects = 0;
+  frames[0] = rootBox.minPoint;
+  int stackIdx = 0;
+  NodeFetchCounter fetches;
+
+  while (stackIdx >= 0) {
+    QuantizedChild subtree = to_visit[stackIdx];
+    Vector3D frame = frames[stackIdx];
+    --stackIdx;
+    if (subtree.isLeaf()) {
+      if (leafOccludes(subtree, origin, unitDirection, maxT))
+        return true;
+      continue;
+    }
+
+    const QuantizedNode &node = quantizedNodes[subtree.index];
+    fetches.fetch(&node);
+    Vector3D childMin[2], childMax[2];
+    float childDistance[2];
+    for (int c = 0; c < 2; ++c) {
+      node.decode(c, frame, childMin[c], childMax[c]);
+      childDistance[c] = intersectAABB(origin, invDirection, childMin[c], childMax[c]);
+    }
+    int nearChild = (childDistance[1] < childDistance[0]) ? 1 : 0;
+    int farChild = 1 - nearChild;
+    if (childDistance[farChild] < maxT) {
+      to_visit[++stackIdx] = node.child[farChild];
+      frames[stackIdx] = childMin[farChild];
+    }
+    if (childDistance[nearChild] < maxT) {
+      to_visit[++stackIdx] = node.child[nearChild];
+      frames[stackIdx] = childMin[nearChild];
+    }
+  }
+
+  return false;
+}
+
+void BVH::splice(std::vector<BVH *>::iterator begin, std::vector<BVH *>::iterator end, int i, int &idx) {
+  if (end - begin == 1) {
+    // copy the subtree as is without its padding, relocating child and arena indices. Subtrees are spliced
+    // in depth first order, so appending their arenas here keeps the arena in leaf order
+    BVH *subtree = *begin;
+    int lineOffset = arena.append(subtree->arena);
+    int nodeOffset = idx - 2;
+    auto relocate = [&](FlattenedNode &flatNode) {
+      if (flatNode.isLeaf()) {
+        flatNode.start += lineOffset;
+      } else {
+        flatNode.left += nodeOffset;
+      }
+    };
+    nodes[i] = subtree->nodes[0];
+    relocate(nodes[i]);
+    for (int j = 2; j < subtree->numNodes; ++j) {
+      nodes[j + nodeOffset] = subtree->nodes[j];
+      relocate(nodes[j + nodeOffset]);
+    }
+    idx += subtree->numNodes - 2;
+    return;
+  }
+
+  Box bounds;
+  Box centroids;
+  for (auto it = begin; it != end; ++it) {
+    const FlattenedNode &root = (*it)->nodes[0];
+    bounds.shrink(root.aabbMin);
+    bounds.expand(root.aabbMax);
+    Vector3D centroid = (root.aabbMin + root.aabbMax) / 2;
+    centroids.shrink(centroid);
+    centroids.expand(centroid);
+  }
+
+  // split the subtrees in half along the axis with the largest centroid extent
+  Vector3D extent = centroids.maxPoint - centroids.minPoint;
+  int axis = 0;
+  if (extent.y > extent[axis])
+    axis = 1;
+  if (extent.z > extent[axis])
+    axis = 2;
+  auto middle = begin + (end - begin) / 2;
+  std::nth_element(begin, middle, end,
+  [axis](const BVH *a, const BVH *b) {
+    return a->nodes[0].aabbMin[axis] + a->nodes[0].aabbMax[axis]
+         < b->nodes[0].aabbMin[axis] + b->nodes[0].aabbMax[axis];
+  });
+
+  int left = idx;
+  idx += 2;
+  splice(begin, middle, left, idx);
+  splice(middle, end, left + 1, idx);
+
+  FlattenedNode &flatNode = nodes[i];
+  flatNode.aabbMin = bounds.minPoint;
+  flatNode.aabbMax = bounds.maxPoint;
+  flatNode.left = left;
+  flatNode.numObjects = 0;
+  flatNode.type = 0;
 }
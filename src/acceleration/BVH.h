@@ -1,5 +1,9 @@
 #pragma once 
 
+#include "Arena.h"
+#include "BVHLayout.h"
+#include "Primitives.h"
+#include "RayPacket.h"
 #include "SafeProgressBar.h"
 
 #include "../macros.h"
@@ -40,31 +44,147 @@ private:
     Node *right;
     int start;
     int numObjects;
+    int type;
 
     bool isLeaf() const {
       return numObjects > 0;
     }
   };
 
+  /**
+   * ClosestHit - nearest hit found so far by a traversal, kept as an arena position so the hit object is
+   * only read once the traversal knows it is the nearest.
+  */
+  struct ClosestHit {
+    PrimitiveHit hit = { INF_D, 0, 0 };
+    int line = -1;
+    int lane = 0;
+    int type = 0;
+  };
+
+  /**
+   * FlattenedNode - a leaf holds numObjects objects of the PrimitiveTypes type tagged type, packed from
+   * line start of the arena. The children of an inner node are at left and left + 1, so traversals test
+   * both from one line. nodes[1] is padding that keeps pairs on even indices.
+  */
   struct FlattenedNode {
     Vector3D aabbMin;
     Vector3D aabbMax;
     union {
-      int right;
+      int left;
       int start;
     };
-    int numObjects;
+    int numObjects : 24;
+    int type : 8;
+
+    inline bool isLeaf() const {
+      return numObjects > 0;
+    }
+  };
+
+  /**
+   * QuantizedChild - child of a QuantizedNode, either the index of an inner node or a leaf laid out like
+   * a FlattenedNode leaf.
+  */
+  struct QuantizedChild {
+    union {
+      int index;
+      int start;
+    };
+    int numObjects : 24;
+    int type : 8;
 
     inline bool isLeaf() const {
       return numObjects > 0;
     }
   };
 
+  /**
+   * QuantizedNode - inner node of the compressed hierarchy. A node's box is decoded by its parent, or is
+   * the root box, and its children's boxes are stored as 8-bit steps of 2^exponent along each axis from
+   * the min corner of that box, rounded outwards so they always contain the real boxes. Leaves have no
+   * node of their own, their parent's QuantizedChild describes them.
+  */
+  struct QuantizedNode {
+    uint8_t lo[2][3];
+    uint8_t hi[2][3];
+    int8_t exponent[3];
+    uint8_t unused;
+    QuantizedChild child[2];
+
+    /**
+     * step - 2^exponent, for exponents in [-126, 127]. Built from its bits, so steps times 8-bit offsets are
+     * exact and decoding gives the same boxes during traversal as while quantizing.
+    */
+    static inline float step(int exponent) {
+      uint32_t bits = uint32_t(exponent + 127) << 23;
+      float value;
+      memcpy(&value, &bits, sizeof(value));
+      return value;
+    }
+
+    /**
+     * decode - box of child c, given the min corner of this node's box.
+    */
+    inline void decode(int c, const Vector3D &frame, Vector3D &aabbMin, Vector3D &aabbMax) const {
+      for (int axis = 0; axis < 3; ++axis) {
+        float scale = step(exponent[axis]);
+        aabbMin[axis] = frame[axis] + lo[c][axis] * scale;
+        aabbMax[axis] = frame[axis] + hi[c][axis] * scale;
+      }
+    }
+  };
+
 public:
-  BVH(std::vector<std::unique_ptr<Object>> &objects, int maxThreads=1);
+  /**
+   * Builds a BVH over objects, which must all be of one of the PrimitiveTypes.
+  */
+  BVH(std::vector<ArenaPtr<Object>> &objects, int maxThreads=1);
+  /**
+   * Splices prebuilt BVHs into a single hierarchy without rebuilding them.
+   * 
+   * objects  - the concatenation of the objects of every subtree, in the same order as subtrees
+   * subtrees - BVHs built independently (e.g. one per mesh) over consecutive ranges of objects
+  */
+  BVH(std::vector<ArenaPtr<Object>> &objects, std::vector<std::unique_ptr<BVH>> &subtrees);
   ~BVH();
   IntersectionInfo findClosestObject(const Vector3D& origin, const Vector3D& direction);
-  bool findAnyObject(const Vector3D& origin, const Vector3D& direction);
+  /**
+   * findAnyObject - whether the ray hits any object closer than maxT, which needs a normalized direction.
+  */
+  bool findAnyObject(const Vector3D& origin, const Vector3D& direction, float maxT=INF_D);
+  /**
+   * findClosestObjects
+   * 
+   * Closest hit of every ray of packet, written to infos[0, packet.size). Nodes are tested against all
+   * rays at once, and skipped without testing single rays when interval bounds on the packet's origins and
+   * directions show that none of them can enter. Packets whose directions don't share signs on every axis
+   * aren't coherent enough for this and fall back to findClosestObject for each ray.
+  */
+  template <int N>
+  void findClosestObjects(const RayPacket<N> &packet, IntersectionInfo *infos);
+  /**
+   * bounds - box around every object in the hierarchy.
+  */
+  Box bounds() const {
+    if (quantizedNodes != nullptr)
+      return rootBox;
+    return (numNodes > 0) ? Box(nodes[0].aabbMin, nodes[0].aabbMax) : Box();
+  }
+  /**
+   * quantize
+   * 
+   * Replaces the nodes with QuantizedNodes, which take 32 bytes per inner node instead of 64 for its two
+   * children, and are decoded during traversal. Boxes get looser by at most 1/255 of their parent's size,
+   * so a few more nodes are visited. Packets of rays are traced one ray at a time afterwards. The hierarchy
+   * can't be spliced once quantized.
+  */
+  void quantize();
+  /**
+   * layout - puts the nodes, still in the depth first order they are built in, in the order of layout.
+   * Call once, before quantize.
+  */
+  void layout(BVHLayout layout);
 
 private:
   void updateNodeBounds(Node *node);
@@ -74,9 +194,60 @@ private:
   PartitionInfo parallelizeSAH(Node *node, int start, int end, int maxThreads);
   PartitionInfo threadPartitionTask(Node *node, int start, int end);
   PartitionInfo findBestBucketSplit(Node *node);
-  void flatten(Node *node, int &idx);
-  std::vector<std::unique_ptr<Object>> &objects;
+  /**
+   * flatten - writes node to nodes[i] and its descendants in depth first order from index idx on.
+  */
+  void flatten(Node *node, int i, int &idx);
+  /**
+   * allocateNodes - uninitialized array of count nodes, aligned to pages.
+  */
+  static FlattenedNode *allocateNodes(int count);
+  /**
+   * quantizeNode - writes the QuantizedNode for the inner node nodeIdx, whose decoded box is
+   * [frameMin, frameMax], and its inner descendants. Inner nodes keep their order, so index maps every
+   * inner node to its QuantizedNode.
+  */
+  void quantizeNode(int nodeIdx, const Vector3D &frameMin, const Vector3D &frameMax, const std::vector<int> &index);
+  IntersectionInfo findClosestObjectQuantized(const Vector3D& origin, const Vector3D& direction);
+  bool findAnyObjectQuantized(const Vector3D& origin, const Vector3D& direction, float maxT);
+  /**
+   * makeLeaf - turns node into a leaf, splitting it into one leaf per type if it holds several. Returns
+   * the number of nodes it becomes.
+  */
+  int makeLeaf(Node *node);
+  /**
+   * packPrimitives - copies the objects of every leaf into the arena in leaf order and points the leaf at them.
+  */
+  void packPrimitives();
+  /**
+   * intersectLeaf - updates closest if a ray with normalized direction hits an object of leaf before closest.hit.t.
+  */
+  template <typename Leaf>
+  void intersectLeaf(const Leaf &leaf, const Vector3D& origin, const Vector3D& direction, ClosestHit &closest) const;
+  /**
+   * resolve - full intersection for closest, reading the hit object's shading data.
+  */
+  IntersectionInfo resolve(const ClosestHit &closest, const Vector3D& origin, const Vector3D& direction) const;
+  /**
+   * leafOccludes - whether a ray with normalized direction hits an object of leaf closer than maxT.
+  */
+  template <typename Leaf>
+  bool leafOccludes(const Leaf &leaf, const Vector3D& origin, const Vector3D& direction, float maxT) const;
+  /**
+   * splice - writes the root of the hierarchy over [begin, end) to nodes[i] and the rest of it from index idx on.
+  */
+  void splice(std::vector<BVH *>::iterator begin, std::vector<BVH *>::iterator end, int i, int &idx);
+  // Objects the tree is being built over, only set during the build
+  std::vector<ArenaPtr<Object>> *objects = nullptr;
+  // Nodes of the tree while it is built, freed together once it is flattened
+  Arena buildNodes;
   FlattenedNode *nodes;
+  // Set by quantize, which frees nodes
+  QuantizedNode *quantizedNodes = nullptr;
+  Box rootBox;
+  PrimitiveArena arena;
+  int numNodes;
+  int numObjects;
   int maxThreads;
   SafeProgressBar progress;
 };
\ No newline at end of file
@@ -0,0 +1,23 @@
+#pragma once
+
+/**
+ * BVHLayout - order BVH::layout puts the nodes in. Sibling nodes always share a 64 byte line, so layouts
+ * order sibling pairs:
+ *
+ *  DepthFirst   - the children of a node come before the rest of the tree after it
+ *  SubtreeSize  - depth first, going into the larger of the two subtrees first
+ *  VanEmdeBoas  - the top half of the levels, then every subtree below it, each laid out the same way, so
+ *                 subtrees of every size are contiguous without knowing the cache size
+ *  LineTreelets - treelets of 2 pairs, filling 128 byte blocks
+ *  PageTreelets - treelets of 64 pairs, filling 4 KB pages
+ *
+ * Treelets are grown from their root by taking the pair with the largest box next, which rays are the
+ * most likely to visit.
+*/
+enum class BVHLayout {
+  DepthFirst,
+  SubtreeSize,
+  VanEmdeBoas,
+  LineTreelets,
+  PageTreelets
+};
@@ -0,0 +1,331 @@
+#pragma once
+
+#include "../macros.h"
+#include "../vector/vector3d.h"
+#include "../scene/Object.h"
+
+// Objects of one type tested together by one call of a leaf kernel. Leaves hold up to MIN_LEAF_SIZE (4)
+// objects, so wider packs would mostly be padding.
+#define PRIMITIVE_PACK_SIZE 4
+
+/**
+ * PrimitiveHit struct
+ *
+ * Nearest hit a leaf kernel found in a pack.
+ *
+ * t    - distance along the ray
+ * u, v - where the hit is on the object, as the object's kernel defines it
+*/
+struct PrimitiveHit {
+  float t;
+  float u;
+  float v;
+};
+
+/**
+ * PrimitiveKernel
+ *
+ * How the BVH stores and intersects one object type without going through Object::intersect. The BVH
+ * copies the objects of every leaf into packs of their type in a PrimitiveArena, so a leaf test is a tight
+ * loop over contiguous memory that the compiler can turn into vector instructions. A specialization provides:
+ *
+ *  Pack - the fields intersect reads for PRIMITIVE_PACK_SIZE objects, each in its own array. Padding
+ *         lanes are value-initialized and set with pad, and must never hit anything.
+ *  static void set(Pack &pack, int lane, const T &obj)
+ *  static void pad(Pack &pack, int lane)
+ *  static int intersect(const Pack &pack, const Vector3D &origin, const Vector3D &direction, float maxT, PrimitiveHit &hit)
+ *    - lane of the nearest object hit closer than maxT, or -1. direction is normalized. Only writes hit on a hit.
+ *  static IntersectionInfo info(const T &obj, const Vector3D &origin, const Vector3D &direction, const PrimitiveHit &hit)
+ *    - full intersection for a hit found by intersect.
+*/
+template <typename T>
+struct PrimitiveKernel;
+
+template <>
+struct PrimitiveKernel<Triangle> {
+  // Fields of Triangle::intersect: first vertex, unit normal and the two barycentric edge vectors
+  struct alignas(64) Pack {
+    float p1x[PRIMITIVE_PACK_SIZE];
+    float p1y[PRIMITIVE_PACK_SIZE];
+    float p1z[PRIMITIVE_PACK_SIZE];
+    float nx[PRIMITIVE_PACK_SIZE];
+    float ny[PRIMITIVE_PACK_SIZE];
+    float nz[PRIMITIVE_PACK_SIZE];
+    float e1x[PRIMITIVE_PACK_SIZE];
+    float e1y[PRIMITIVE_PACK_SIZE];
+    float e1z[PRIMITIVE_PACK_SIZE];
+    float e2x[PRIMITIVE_PACK_SIZE];
+    float e2y[PRIMITIVE_PACK_SIZE];
+    float e2z[PRIMITIVE_PACK_SIZE];
+  };
+
+  static void set(Pack &pack, int lane, const Triangle &triangle) {
+    pack.p1x[lane] = triangle.p1.x;
+    pack.p1y[lane] = triangle.p1.y;
+    pack.p1z[lane] = triangle.p1.z;
+    pack.nx[lane] = triangle.normal.x;
+    pack.ny[lane] = triangle.normal.y;
+    pack.nz[lane] = triangle.normal.z;
+    pack.e1x[lane] = triangle.e1.x;
+    pack.e1y[lane] = triangle.e1.y;
+    pack.e1z[lane] = triangle.e1.z;
+    pack.e2x[lane] = triangle.e2.x;
+    pack.e2y[lane] = triangle.e2.y;
+    pack.e2z[lane] = triangle.e2.z;
+  }
+
+  // A zero normal makes the distance NaN
+  static void pad(Pack &, int) {}
+
+  // Same arithmetic as Triangle::intersect on every lane, without branches
+  static int intersect(const Pack &pack, const Vector3D &origin, const Vector3D &direction, float maxT, PrimitiveHit &hit) {
+    float t[PRIMITIVE_PACK_SIZE];
+    float b2[PRIMITIVE_PACK_SIZE];
+    float b3[PRIMITIVE_PACK_SIZE];
+    for (int i = 0; i < PRIMITIVE_PACK_SIZE; ++i) {
+      float dx = pack.p1x[i] - origin.x;
+      float dy = pack.p1y[i] - origin.y;
+      float dz = pack.p1z[i] - origin.z;
+      float ti = (dx * pack.nx[i] + dy * pack.ny[i] + dz * pack.nz[i])
+               / (direction.x * pack.nx[i] + direction.y * pack.ny[i] + direction.z * pack.nz[i]);
+      float qx = (direction.x * ti + origin.x) - pack.p1x[i];
+      float qy = (direction.y * ti + origin.y) - pack.p1y[i];
+      float qz = (direction.z * ti + origin.z) - pack.p1z[i];
+      b2[i] = pack.e1x[i] * qx + pack.e1y[i] * qy + pack.e1z[i] * qz;
+      b3[i] = pack.e2x[i] * qx + pack.e2y[i] * qy + pack.e2z[i] * qz;
+      float b1 = 1.0f - b3[i] - b2[i];
+      // NaN distances from padding and rays parallel to a triangle fail every comparison
+      bool isHit = ti >= 0 && ti < maxT
+                && b1 >= 0 && b1 <= 1 && b2[i] >= 0 && b2[i] <= 1 && b3[i] >= 0 && b3[i] <= 1;
+      t[i] = isHit ? ti : INF_D;
+    }
+
+    int nearest = -1;
+    for (int i = 0; i < PRIMITIVE_PACK_SIZE; ++i) {
+      if (t[i] < maxT) {
+        maxT = t[i];
+        nearest = i;
+      }
+    }
+    if (nearest >= 0)
+      hit = { t[nearest], b2[nearest], b3[nearest] };
+    return nearest;
+  }
+
+  static IntersectionInfo info(const Triangle &triangle, const Vector3D &origin, const Vector3D &direction, const PrimitiveHit &hit) {
+    return triangle.intersection(hit.t, hit.t * direction + origin, hit.u, hit.v);
+  }
+};
+
+template <>
+struct PrimitiveKernel<Sphere> {
+  // Center and squared radius
+  struct alignas(64) Pack {
+    float cx[PRIMITIVE_PACK_SIZE];
+    float cy[PRIMITIVE_PACK_SIZE];
+    float cz[PRIMITIVE_PACK_SIZE];
+    float r2[PRIMITIVE_PACK_SIZE];
+  };
+
+  static void set(Pack &pack, int lane, const Sphere &sphere) {
+    pack.cx[lane] = sphere.center.x;
+    pack.cy[lane] = sphere.center.y;
+    pack.cz[lane] = sphere.center.z;
+    pack.r2[lane] = sphere.r * sphere.r;
+  }
+
+  // Nothing is inside a sphere with negative squared radius or close enough to its center to hit it
+  static void pad(Pack &pack, int lane) {
+    pack.r2[lane] = -1;
+  }
+
+  // Same arithmetic as Sphere::intersect on every lane, without branches
+  static int intersect(const Pack &pack, const Vector3D &origin, const Vector3D &direction, float maxT, PrimitiveHit &hit) {
+    float t[PRIMITIVE_PACK_SIZE];
+    for (int i = 0; i < PRIMITIVE_PACK_SIZE; ++i) {
+      float dx = pack.cx[i] - origin.x;
+      float dy = pack.cy[i] - origin.y;
+      float dz = pack.cz[i] - origin.z;
+      bool inside = dx * dx + dy * dy + dz * dz < pack.r2[i];
+      float tc = dx * direction.x + dy * direction.y + dz * direction.z;
+      float qx = (origin.x + direction.x * tc) - pack.cx[i];
+      float qy = (origin.y + direction.y * tc) - pack.cy[i];
+      float qz = (origin.z + direction.z * tc) - pack.cz[i];
+      float distanceSquared = qx * qx + qy * qy + qz * qz;
+      bool misses = !inside && (tc < 0 || pack.r2[i] < distanceSquared);
+      float offset = sqrtf(std::max(pack.r2[i] - distanceSquared, 0.0f));
+      float ti = inside ? tc + offset : tc - offset;
+      t[i] = (!misses && ti < maxT) ? ti : INF_D;
+    }
+
+    int nearest = -1;
+    for (int i = 0; i < PRIMITIVE_PACK_SIZE; ++i) {
+      if (t[i] < maxT) {
+        maxT = t[i];
+        nearest = i;
+      }
+    }
+    if (nearest >= 0)
+      hit = { t[nearest], 0, 0 };
+    return nearest;
+  }
+
+  static IntersectionInfo info(const Sphere &sphere, const Vector3D &origin, const Vector3D &direction, const PrimitiveHit &hit) {
+    return sphere.intersection(hit.t, hit.t * direction + origin);
+  }
+};
+
+/**
+ * CacheLine struct - one line of PrimitiveArena storage.
+*/
+struct alignas(64) CacheLine {
+  unsigned char bytes[64];
+};
+
+/**
+ * class PrimitiveArena
+ *
+ * Every object of a BVH, copied into one contiguous block in the order the BVH's leaves are laid out. The
+ * objects of a leaf are split into packs of their type. Each pack is followed by one line holding a
+ * pointer per lane back to the object:
+ *
+ *  [pack lines read by the kernel][object line] [pack lines][object line] ...
+ *
+ * A leaf test streams through hot pack lines. The object line, and the Object with the shading data
+ * behind it, are only read for the nearest hit.
+ *
+ * private members:
+ *  lines - the arena
+*/
+class PrimitiveArena {
+public:
+  template <typename T>
+  using Pack = typename PrimitiveKernel<T>::Pack;
+
+  /**
+   * packLines - lines a pack of T and its object line take.
+  */
+  template <typename T>
+  static constexpr int packLines() {
+    static_assert(sizeof(Pack<T>) % sizeof(CacheLine) == 0, "packs must fill whole cache lines");
+    static_assert(PRIMITIVE_PACK_SIZE * sizeof(const T *) <= sizeof(CacheLine), "object pointers must fit in a line");
+    return sizeof(Pack<T>) / sizeof(CacheLine) + 1;
+  }
+
+  /**
+   * linesFor - lines count objects of T take.
+  */
+  template <typename T>
+  static int linesFor(int count) {
+    return (count + PRIMITIVE_PACK_SIZE - 1) / PRIMITIVE_PACK_SIZE * packLines<T>();
+  }
+
+  /**
+   * append - packs count objects of T starting at first, returning the line their first pack starts at.
+  */
+  template <typename T, typename Iterator>
+  int append(Iterator first, int count) {
+    using Kernel = PrimitiveKernel<T>;
+    int firstLine = lines.size();
+    lines.resize(firstLine + linesFor<T>(count));
+    for (int i = 0, line = firstLine; i < count; i += PRIMITIVE_PACK_SIZE, line += packLines<T>()) {
+      Pack<T> *pack = new (&lines[line]) Pack<T>();
+      const T *objects[PRIMITIVE_PACK_SIZE] = {};
+      for (int lane = 0; lane < PRIMITIVE_PACK_SIZE; ++lane) {
+        if (i + lane < count) {
+          objects[lane] = static_cast<const T *>(first[i + lane].get());
+          Kernel::set(*pack, lane, *objects[lane]);
+        } else {
+          Kernel::pad(*pack, lane);
+        }
+      }
+      std::memcpy(&lines[line + packLines<T>() - 1], objects, sizeof(objects));
+    }
+    return firstLine;
+  }
+
+  /**
+   * append - copies every line of other, returning the line other's first line now is.
+  */
+  int append(const PrimitiveArena &other) {
+    int firstLine = lines.size();
+    lines.insert(lines.end(), other.lines.begin(), other.lines.end());
+    return firstLine;
+  }
+
+  void reserve(size_t numLines) {
+    lines.reserve(numLines);
+  }
+
+  size_t size() const {
+    return lines.size();
+  }
+
+  /**
+   * bytes - memory the arena takes.
+  */
+  size_t bytes() const {
+    return lines.size() * sizeof(CacheLine);
+  }
+
+  template <typename T>
+  const Pack<T> &pack(int line) const {
+    return *std::launder(reinterpret_cast<const Pack<T> *>(&lines[line]));
+  }
+
+  template <typename T>
+  const T *object(int line, int lane) const {
+    const T *obj;
+    std::memcpy(&obj, lines[line + packLines<T>() - 1].bytes + lane * sizeof(obj), sizeof(obj));
+    return obj;
+  }
+
+private:
+  std::vector<CacheLine> lines;
+};
+
+/**
+ * PrimitiveTag - stands in for a value of type T when dispatching on a type tag.
+*/
+template <typename T>
+struct PrimitiveTag {
+  using type = T;
+};
+
+/**
+ * PrimitiveRegistry
+ *
+ * The object types the BVH can store, each with a PrimitiveKernel. The index of a type in the list is the
+ * tag BVH leaves carry, and leaf tests dispatch on the tag to the type's kernel. Adding a type to
+ * PrimitiveTypes is all the BVH needs to store it.
+*/
+template <typename... Types>
+struct PrimitiveRegistry {
+  static constexpr int count = sizeof...(Types);
+
+  /**
+   * typeOf - tag of the registered type obj is, or -1 if it isn't one.
+  */
+  static int typeOf(const Object &obj) {
+    int type = -1;
+    int index = 0;
+    ((type = (type < 0 && dynamic_cast<const Types *>(&obj) != nullptr) ? index : type, ++index), ...);
+    return type;
+  }
+
+  /**
+   * visit - calls func with PrimitiveTag<T> for the type T tagged type.
+  */
+  template <typename Func>
+  static void visit(int type, Func &&func) {
+    visit(type, func, std::index_sequence_for<Types...>());
+  }
+
+private:
+  template <typename Func, size_t... I>
+  static void visit(int type, Func &func, std::index_sequence<I...>) {
+    ((type == static_cast<int>(I) ? (func(PrimitiveTag<Types>()), 0) : 0), ...);
+  }
+};
+
+using PrimitiveTypes = PrimitiveRegistry<Triangle, Sphere>;
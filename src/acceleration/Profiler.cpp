@@ -1,9 +1,23 @@
 #include "Profiler.h"
+#include "Arena.h"
 
 #include "../macros.h"
 
 static Stats stats;
 
+// NodeFetchCounter totals
+static std::atomic<uint64_t> traversals{0};
+static std::atomic<uint64_t> nodeFetches{0};
+static std::atomic<uint64_t> sameBlockFetches{0};
+static std::atomic<uint64_t> samePageFetches{0};
+
+void addNodeFetches(const NodeFetchCounter &counter) {
+  traversals.fetch_add(1, std::memory_order_relaxed);
+  nodeFetches.fetch_add(counter.fetches, std::memory_order_relaxed);
+  sameBlockFetches.fetch_add(counter.sameBlock, std::memory_order_relaxed);
+  samePageFetches.fetch_add(counter.samePage, std::memory_order_relaxed);
+}
+
 Profiler::~Profiler() {
   std::chrono::system_clock::time_point end = std::chrono::system_clock::now();
   std::chrono::duration<float> elapsed_seconds = end - start;
@@ -20,4 +34,11 @@ void Stats::print() {
 
 void printStats() {
   stats.print();
+  if (traversals > 0) {
+    std::cout << "BVH traversals: " << traversals << " reading " << std::fixed << std::setprecision(2)
+              << double(nodeFetches) / traversals << " nodes each, "
+              << 100.0 * sameBlockFetches / nodeFetches << "% in the 128 byte block of the node before and "
+              << 100.0 * samePageFetches / nodeFetches << "% in its page" << std::endl;
+  }
+  Arena::printStats();
 }
@@ -4,6 +4,7 @@
 
 enum class Funcs {
   SceneConstruction,
+  AssetLoading,
   BVHConstruction,
 
   Render,
@@ -18,6 +19,7 @@ enum class Funcs {
 
 static const char * FuncNames[] = {
   "Scene construction",
+  "Asset loading",
   "BVH construction",
   "Rendering",
   "Raytracing",
@@ -43,6 +45,46 @@ private:
 
 void printStats();
 
+class NodeFetchCounter;
+void addNodeFetches(const NodeFetchCounter &counter);
+
+/**
+ * class NodeFetchCounter
+ *
+ * Counts the BVH nodes a traversal reads and how close each is in memory to the one read before it, which
+ * shows how well a node layout keeps traversals local. Does nothing unless PROFILE_LAYOUT is defined, and
+ * adds its counts to the totals printed by printStats when destroyed.
+ *
+ * fetches   - nodes read
+ * sameBlock - nodes within the 128 byte block of the node before
+ * samePage  - nodes within the 4 KB page of the node before
+*/
+class NodeFetchCounter {
+public:
+  ~NodeFetchCounter() {
+    #ifdef PROFILE_LAYOUT
+    addNodeFetches(*this);
+    #endif
+  }
+
+  inline void fetch(const void *node) {
+    #ifdef PROFILE_LAYOUT
+    uintptr_t address = reinterpret_cast<uintptr_t>(node);
+    ++fetches;
+    sameBlock += (address / 128 == previous / 128);
+    samePage += (address / 4096 == previous / 4096);
+    previous = address;
+    #endif
+  }
+
+  uint64_t fetches = 0;
+  uint64_t sameBlock = 0;
+  uint64_t samePage = 0;
+
+private:
+  uintptr_t previous = 0;
+};
+
 class Profiler {
 public:
   Profiler(Funcs f) : f_(f), start(std::chrono::system_clock::now()) {};
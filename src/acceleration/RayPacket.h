@@ -0,0 +1,36 @@
+#pragma once
+
+#include "../vector/vector3d.h"
+
+// Widest ray packet BVH::findClosestObjects takes
+#define MAX_PACKET_SIZE 8
+
+/**
+ * RayPacket struct
+ *
+ * Rays traced through the BVH together, with every component in its own array so each step of the
+ * traversal runs the same instructions over all lanes.
+ *
+ * ox, oy, oz - ray origins
+ * dx, dy, dz - ray directions
+ * size       - number of lanes in use, at most N
+*/
+template <int N>
+struct RayPacket {
+  float ox[N];
+  float oy[N];
+  float oz[N];
+  float dx[N];
+  float dy[N];
+  float dz[N];
+  int size;
+
+  void set(int lane, const Vector3D &origin, const Vector3D &direction) {
+    ox[lane] = origin.x;
+    oy[lane] = origin.y;
+    oz[lane] = origin.z;
+    dx[lane] = direction.x;
+    dy[lane] = direction.y;
+    dz[lane] = direction.z;
+  }
+};
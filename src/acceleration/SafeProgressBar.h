@@ -9,12 +9,16 @@ public:
   SafeProgressBar() : counter(0), barWidth(70), total(100), update(1.0), inc(1.0) {
     displayRenderProgress(0.0f, barWidth);
   };
-  SafeProgressBar(int width, int total, int update) : counter(0), barWidth(width), total(total), update(update), inc(update) {
-    displayRenderProgress(0.0f, barWidth);
+  SafeProgressBar(int width, int total, int update, bool visible=true)
+    : counter(0), barWidth(width), total(total), update(update), inc(update), visible(visible) {
+    if (visible)
+      displayRenderProgress(0.0f, barWidth);
   };
   void increment(int amount=1) {
     std::lock_guard<std::mutex> lock(m);
     counter += amount;
+    if (!visible)
+      return;
     if (counter == total || counter >= update) {
       displayRenderProgress(static_cast<float>(counter) / total, barWidth);
       update += inc;
@@ -30,4 +34,5 @@ private:
   int total;
   int update;
   int inc;
+  bool visible;
 };
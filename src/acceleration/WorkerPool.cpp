@@ -0,0 +1,52 @@
+#include "WorkerPool.h"
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(m);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+}
+
+void WorkerPool::run(int numThreads, const std::function<void ()> &func) {
+  std::lock_guard<std::mutex> runLock(runMutex);
+  int helpers = std::max(numThreads, 1) - 1;
+  if (helpers > 0) {
+    std::lock_guard<std::mutex> lock(m);
+    while (static_cast<int>(threads.size()) < helpers) {
+      threads.emplace_back(&WorkerPool::workerLoop, this, generation);
+    }
+    job = &func;
+    wanted = helpers;
+    claimed = 0;
+    pending = helpers;
+    ++generation;
+  }
+  wake.notify_all();
+
+  func();
+
+  std::unique_lock<std::mutex> lock(m);
+  done.wait(lock, [this]() { return pending == 0; });
+  job = nullptr;
+}
+
+void WorkerPool::workerLoop(uint64_t seen) {
+  std::unique_lock<std::mutex> lock(m);
+  while (true) {
+    wake.wait(lock, [&]() { return stopping || (generation != seen && claimed < wanted); });
+    if (stopping)
+      return;
+    seen = generation;
+    ++claimed;
+    const std::function<void ()> *current = job;
+    lock.unlock();
+    (*current)();
+    lock.lock();
+    if (--pending == 0)
+      done.notify_one();
+  }
+}
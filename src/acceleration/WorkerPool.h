@@ -0,0 +1,48 @@
+#pragma once
+
+#include "../macros.h"
+
+/**
+ * class WorkerPool
+ *
+ * Threads kept alive between calls to run, for callers that split many short jobs across threads, where
+ * starting threads every time would cost more than the work. Threads are started the first time a run
+ * needs them and joined when the pool is destroyed. Concurrent calls to run take turns.
+ *
+ * private members:
+ *  threads    - the pool's threads, which wait for jobs between runs
+ *  job        - job of the current run, nullptr between runs
+ *  generation - incremented for every run so threads only take each job once
+ *  wanted     - threads of the pool the current run uses
+ *  claimed    - threads that have taken the current job
+ *  pending    - threads still running the current job
+ *  stopping   - set by the destructor to end the threads
+*/
+class WorkerPool {
+public:
+  WorkerPool() {};
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+  ~WorkerPool();
+
+  /**
+   * run - calls job once on each of numThreads threads, the calling thread being one of them, and returns
+   * once every call has returned.
+  */
+  void run(int numThreads, const std::function<void ()> &job);
+
+private:
+  void workerLoop(uint64_t seen);
+
+  std::vector<std::thread> threads;
+  std::mutex runMutex;
+  std::mutex m;
+  std::condition_variable wake;
+  std::condition_variable done;
+  const std::function<void ()> *job = nullptr;
+  uint64_t generation = 0;
+  int wanted = 0;
+  int claimed = 0;
+  int pending = 0;
+  bool stopping = false;
+};
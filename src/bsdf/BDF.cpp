@@ -10,7 +10,7 @@ BDFType operator&(BDFType lhs, BDFType rhs) {
                               static_cast<std::underlying_type<BDFType>::type>(rhs));
 }
 
-float BDF::sampleFunc(const Vector3D &wo, Vector3D *wi, const Vector3D &n, UniformDistribution &sampler, float *pdf, BDFType *type) const {
+float BDF::sampleFunc(const Vector3D &wo, Vector3D *wi, const Vector3D &n, Sampler &sampler, float *pdf, BDFType *type) const {
   *wi = sampleHemisphere(n, sampler);
   *pdf = this->pdf(wo, *wi, n);
   *type = BDFType::DIFFUSE;
@@ -18,11 +18,12 @@ float BDF::sampleFunc(const Vector3D &wo, Vector3D *wi, const Vector3D &n, Unifo
 }
 
 float BDF::pdf(const Vector3D &wo, const Vector3D &wi, const Vector3D &n) const {
-  // Check if wo and wi are in the same direction before returning pdf
-  return (dot(wo, wi) > 0) ? std::abs(dot(wi, n)) * M_1_PI * 2: 0;
+  // Check if wo and wi are in the same direction before returning pdf.
+  // sampleHemisphere only samples the side n points to
+  return (dot(wo, wi) > 0 && dot(wi, n) > 0) ? dot(wi, n) * M_1_PI : 0;
 }
 
-float SpecularReflection::sampleFunc(const Vector3D &wo, Vector3D *wi, const Vector3D &n, UniformDistribution &sampler, float *pdf, BDFType *type) const {
+float SpecularReflection::sampleFunc(const Vector3D &wo, Vector3D *wi, const Vector3D &n, Sampler &sampler, float *pdf, BDFType *type) const {
   *wi = reflect(wo, n);
   *pdf = 1.0f;
   *type = BDFType::PERFECT_SPECULAR;
@@ -30,7 +31,7 @@ float SpecularReflection::sampleFunc(const Vector3D &wo, Vector3D *wi, const Vec
   return fresnel->evaluate(cosThetaI) * Kr / std::abs(cosThetaI);
 }
 
-float SpecularTransmission::sampleFunc(const Vector3D &wo, Vector3D *wi, const Vector3D &n, UniformDistribution &sampler, float *pdf, BDFType *type) const {
+float SpecularTransmission::sampleFunc(const Vector3D &wo, Vector3D *wi, const Vector3D &n, Sampler &sampler, float *pdf, BDFType *type) const {
   bool entering = dot(wo, n) > 0;
   float etaI = entering ? etaI_ : etaT_;
   float etaT = entering ? etaT_ : etaI_;
@@ -46,7 +47,7 @@ float SpecularTransmission::sampleFunc(const Vector3D &wo, Vector3D *wi, const V
   return Ft / std::abs(cosThetaI);
 }
 
-float FresnelSpecular::sampleFunc(const Vector3D &wo, Vector3D *wi, const Vector3D &n, UniformDistribution &sampler, float *pdf, BDFType *type) const {
+float FresnelSpecular::sampleFunc(const Vector3D &wo, Vector3D *wi, const Vector3D &n, Sampler &sampler, float *pdf, BDFType *type) const {
   float sample = sampler();
   float cosThetaI = dot(wo, n);
   *type = BDFType::PERFECT_SPECULAR;
@@ -103,14 +104,17 @@ float MicrofacetReflection::func(const Vector3D &wo, const Vector3D &wi, const V
   return Kr * distribution->distribution(wh, n) * distribution->geometry(wo, wi, n) * F / (4 * cosThetaI * cosThetaO);
 }
 
-float MicrofacetReflection::sampleFunc(const Vector3D &wo, Vector3D *wi, const Vector3D &n, UniformDistribution &sampler, float *pdf, BDFType *type) const {
+float MicrofacetReflection::sampleFunc(const Vector3D &wo, Vector3D *wi, const Vector3D &n, Sampler &sampler, float *pdf, BDFType *type) const {
   Vector3D wh = distribution->sample_wh(wo, n, sampler);
   *wi = reflect(wo, wh);
-  // if (dot(wo, *wi) < 0)
-  //   return 0;
+  *type = BDFType::REFLECTION;
+  // Match pdf, which has no density for directions that turn back on wo
+  if (dot(wo, *wi) < 0) {
+    *pdf = 0;
+    return 0;
+  }
 
   *pdf = distribution->pdf(wo, wh, n) / (4 * std::abs(dot(wo, wh)));
-  *type = BDFType::REFLECTION;
   return func(wo, *wi, n);
 }
 
@@ -130,7 +134,7 @@ float BSDF::func(const Vector3D &wo, const Vector3D &wi, const Vector3D &n) cons
   return contribution;
 }
 
-float BSDF::sampleFunc(const Vector3D &wo, Vector3D *wi, const Vector3D &n, UniformDistribution &sampler, float *pdf, BDFType *type) const {
+float BSDF::sampleFunc(const Vector3D &wo, Vector3D *wi, const Vector3D &n, Sampler &sampler, float *pdf, BDFType *type) const {
   int numBDFs = bdfs.size();
   // somehow there is a segfault here because idx == numBDFs
   // even though it shouldn't happen because random number is between [0, 1)?
@@ -0,0 +1,119 @@
+#include "Distribution.h"
+
+Distribution1D::Distribution1D(const float *values, int n)
+  : func(values, values + n), cdf(n + 1)
+{
+  cdf[0] = 0;
+  for (int i = 0; i < n; ++i) {
+    cdf[i + 1] = cdf[i] + std::abs(func[i]) / n;
+  }
+  integral = cdf[n];
+
+  // Fall back to a uniform distribution when the function is zero everywhere
+  for (int i = 1; i <= n; ++i) {
+    cdf[i] = (integral == 0) ? static_cast<float>(i) / n : cdf[i] / integral;
+  }
+}
+
+float Distribution1D::sample(float u, float *pdf, int *offset) const {
+  // Find the last cdf entry that is <= u
+  int n = count();
+  int idx = std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin() - 1;
+  idx = std::max(0, std::min(idx, n - 1));
+  if (offset != nullptr)
+    *offset = idx;
+
+  *pdf = (integral > 0) ? std::abs(func[idx]) / integral : 1.0f;
+
+  float du = u - cdf[idx];
+  float width = cdf[idx + 1] - cdf[idx];
+  if (width > 0)
+    du /= width;
+  return std::min((idx + du) / n, 1.0f - std::numeric_limits<float>::epsilon());
+}
+
+float Distribution1D::pdf(float x) const {
+  int n = count();
+  int idx = std::max(0, std::min(static_cast<int>(x * n), n - 1));
+  return (integral > 0) ? std::abs(func[idx]) / integral : 1.0f;
+}
+
+Distribution2D::Distribution2D(const float *values, int nu, int nv) {
+  conditional.reserve(nv);
+  std::vector<float> rowIntegrals(nv);
+  for (int v = 0; v < nv; ++v) {
+    conditional.emplace_back(values + v * nu, nu);
+    rowIntegrals[v] = conditional.back().funcIntegral();
+  }
+  marginal = Distribution1D(rowIntegrals.data(), nv);
+}
+
+std::pair<float, float> Distribution2D::sample(float u0, float u1, float *pdf) const {
+  float pdfs[2];
+  int v;
+  float y = marginal.sample(u1, &pdfs[1], &v);
+  float x = conditional[v].sample(u0, &pdfs[0]);
+  *pdf = pdfs[0] * pdfs[1];
+  return { x, y };
+}
+
+float Distribution2D::pdf(float u, float v) const {
+  int nv = conditional.size();
+  int row = std::max(0, std::min(static_cast<int>(v * nv), nv - 1));
+  return conditional[row].pdf(u) * marginal.pdf(v);
+}
+
+AliasTable::AliasTable(const float *weights, int n)
+  : buckets(n), pmfs(n)
+{
+  float sum = 0;
+  for (int i = 0; i < n; ++i) {
+    sum += std::max(0.0f, weights[i]);
+  }
+  for (int i = 0; i < n; ++i) {
+    pmfs[i] = (sum > 0) ? std::max(0.0f, weights[i]) / sum : 1.0f / n;
+  }
+
+  // Split items into those below and above the average probability, then fill each
+  // small bucket up to the average with probability taken from a large item
+  std::vector<std::pair<int, float>> small;
+  std::vector<std::pair<int, float>> large;
+  for (int i = 0; i < n; ++i) {
+    float scaled = pmfs[i] * n;
+    if (scaled < 1)
+      small.push_back({ i, scaled });
+    else
+      large.push_back({ i, scaled });
+  }
+
+  while (!small.empty() && !large.empty()) {
+    std::pair<int, float> under = small.back();
+    small.pop_back();
+    std::pair<int, float> &over = large.back();
+    buckets[under.first] = { under.second, over.first };
+
+    over.second -= 1.0f - under.second;
+    if (over.second < 1) {
+      small.push_back(over);
+      large.pop_back();
+    }
+  }
+
+  // Whatever is left over is within rounding error of the average
+  for (const std::pair<int, float> &item : small) {
+    buckets[item.first] = { 1.0f, item.first };
+  }
+  for (const std::pair<int, float> &item : large) {
+    buckets[item.first] = { 1.0f, item.first };
+  }
+}
+
+int AliasTable::sample(float u, float *pmf) const {
+  int n = count();
+  int idx = std::min(static_cast<int>(u * n), n - 1);
+  // Reuse the remainder of u to choose between the bucket's item and its alias
+  float up = std::min(u * n - idx, 1.0f - std::numeric_limits<float>::epsilon());
+  int item = (up < buckets[idx].keep) ? idx : buckets[idx].alias;
+  *pmf = pmfs[item];
+  return item;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "../macros.h"
+
+/**
+ * class Distribution1D
+ *
+ * Piecewise-constant distribution over [0, 1) built from a tabulated function.
+ * Samples are drawn by inverting the CDF with a binary search.
+ *
+ * private members:
+ *  func     - function values of each of the equally sized pieces
+ *  cdf      - running integral of func, normalized to end at 1
+ *  integral - integral of func over [0, 1)
+*/
+class Distribution1D {
+public:
+  Distribution1D() : integral(0) {};
+  Distribution1D(const float *values, int n);
+
+  /**
+   * sample
+   *
+   * Maps a uniform sample in [0, 1) to a point in [0, 1) distributed proportional to func.
+   *
+   * u      - uniform sample
+   * pdf    - filled with the density of the returned point
+   * offset - filled with the index of the piece containing the returned point
+  */
+  float sample(float u, float *pdf, int *offset=nullptr) const;
+
+  /**
+   * pdf - density of sampling the point x in [0, 1).
+  */
+  float pdf(float x) const;
+
+  int count() const {
+    return func.size();
+  }
+
+  float funcIntegral() const {
+    return integral;
+  }
+
+private:
+  std::vector<float> func;
+  std::vector<float> cdf;
+  float integral;
+};
+
+/**
+ * class Distribution2D
+ *
+ * Piecewise-constant distribution over [0, 1)^2 built from a row-major grid of function values.
+ * A point is sampled by picking a row from the marginal distribution and then a column
+ * from that row's conditional distribution.
+ *
+ * private members:
+ *  conditional - distribution of u within each row
+ *  marginal    - distribution of v over the rows
+*/
+class Distribution2D {
+public:
+  Distribution2D() {};
+  Distribution2D(const float *values, int nu, int nv);
+
+  /**
+   * sample
+   *
+   * Returns (u, v) distributed proportional to the grid values and fills pdf with their density.
+   *
+   * u0, u1 - uniform samples
+  */
+  std::pair<float, float> sample(float u0, float u1, float *pdf) const;
+
+  /**
+   * pdf - density of sampling the point (u, v).
+  */
+  float pdf(float u, float v) const;
+
+  bool empty() const {
+    return conditional.empty();
+  }
+
+  /**
+   * funcIntegral - integral of the grid values over [0, 1)^2.
+  */
+  float funcIntegral() const {
+    return marginal.funcIntegral();
+  }
+
+private:
+  std::vector<Distribution1D> conditional;
+  Distribution1D marginal;
+};
+
+/**
+ * class AliasTable
+ *
+ * Discrete distribution over n items that is sampled in constant time with Vose's alias method.
+ * Each bucket holds an item and the probability of keeping it, otherwise its alias is returned.
+ *
+ * private members:
+ *  buckets - probability of keeping each bucket's item and the item to return instead
+ *  pmfs    - normalized probability of each item
+*/
+class AliasTable {
+public:
+  AliasTable() {};
+  AliasTable(const float *weights, int n);
+
+  /**
+   * sample
+   *
+   * Picks an item proportional to its weight.
+   *
+   * u   - uniform sample
+   * pmf - filled with the probability of the returned item
+  */
+  int sample(float u, float *pmf) const;
+
+  float pmf(int i) const {
+    return pmfs[i];
+  }
+
+  int count() const {
+    return pmfs.size();
+  }
+
+private:
+  struct Bucket {
+    float keep;
+    int alias;
+  };
+
+  std::vector<Bucket> buckets;
+  std::vector<float> pmfs;
+};
@@ -0,0 +1,124 @@
+#include "Sampler.h"
+
+#define SOBOL_BITS 32
+#define SOBOL_GROUP_SIZE 4
+
+// The top 24 bits fill a float mantissa exactly, so the result can never round up to 1
+static inline float toUnitFloat(uint32_t bits) {
+  return (bits >> 8) * 0x1p-24f;
+}
+
+// Direction numbers of the first 4 Sobol dimensions from Joe and Kuo's primitive polynomials
+static const std::array<std::array<uint32_t, SOBOL_BITS>, SOBOL_GROUP_SIZE> SobolDirections = []() {
+  struct Polynomial {
+    int degree;
+    uint32_t coefficients;
+    std::array<uint32_t, 3> initial;
+  };
+  const Polynomial polynomials[SOBOL_GROUP_SIZE - 1] = {
+    { 1, 0, { 1, 0, 0 } },
+    { 2, 1, { 1, 3, 0 } },
+    { 3, 1, { 1, 3, 1 } }
+  };
+
+  std::array<std::array<uint32_t, SOBOL_BITS>, SOBOL_GROUP_SIZE> directions;
+  // The first dimension is the van der Corput sequence
+  for (int i = 0; i < SOBOL_BITS; ++i) {
+    directions[0][i] = 1u << (SOBOL_BITS - 1 - i);
+  }
+
+  for (int d = 1; d < SOBOL_GROUP_SIZE; ++d) {
+    const Polynomial &p = polynomials[d - 1];
+    std::array<uint32_t, SOBOL_BITS> &v = directions[d];
+    for (int i = 0; i < p.degree; ++i) {
+      v[i] = p.initial[i] << (SOBOL_BITS - 1 - i);
+    }
+    for (int i = p.degree; i < SOBOL_BITS; ++i) {
+      v[i] = v[i - p.degree] ^ (v[i - p.degree] >> p.degree);
+      for (int k = 1; k < p.degree; ++k) {
+        if ((p.coefficients >> (p.degree - 1 - k)) & 1)
+          v[i] ^= v[i - k];
+      }
+    }
+  }
+  return directions;
+}();
+
+static inline uint32_t sobol(uint32_t index, int dimension) {
+  uint32_t x = 0;
+  for (int bit = 0; index != 0; index >>= 1, ++bit) {
+    if (index & 1)
+      x ^= SobolDirections[dimension][bit];
+  }
+  return x;
+}
+
+static inline uint32_t reverseBits(uint32_t x) {
+  x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+  x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+  x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+  x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+// Owen scrambling: flips every bit depending on the bits above it, with a hash standing in for the random tree
+static inline uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+  x = reverseBits(x);
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return reverseBits(x);
+}
+
+static inline uint32_t hashCombine(uint32_t seed, uint32_t value) {
+  return seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+void RandomSampler::startSample(uint32_t seed, uint32_t pixel, uint32_t sampleIndex) {
+  key = mixBits((static_cast<uint64_t>(seed) << 32 | sampleIndex) + 0x9E3779B97F4A7C15ull);
+  stream = pixel;
+  setDimension(0);
+}
+
+void RandomSampler::setDimension(uint32_t dimension) {
+  this->dimension = dimension;
+  rng.seed(mixBits(key ^ (stream << 32 | dimension)), stream);
+}
+
+float RandomSampler::operator()() {
+  ++dimension;
+  return toUnitFloat(rng());
+}
+
+void SobolSampler::startSample(uint32_t seed, uint32_t pixel, uint32_t sampleIndex) {
+  pixelKey = mixBits(static_cast<uint64_t>(seed) << 32 | pixel);
+  this->sampleIndex = sampleIndex;
+  group = -1;
+  setDimension(0);
+}
+
+void SobolSampler::setDimension(uint32_t dimension) {
+  this->dimension = dimension;
+}
+
+float SobolSampler::operator()() {
+  int64_t currentGroup = dimension / SOBOL_GROUP_SIZE;
+  if (currentGroup != group) {
+    group = currentGroup;
+    uint32_t groupSeed = static_cast<uint32_t>(mixBits(pixelKey + static_cast<uint64_t>(group) * 0x9E3779B97F4A7C15ull));
+    // Shuffling the index decorrelates the groups while keeping each one stratified
+    uint32_t index = nestedUniformScramble(sampleIndex, groupSeed);
+    for (int i = 0; i < SOBOL_GROUP_SIZE; ++i) {
+      values[i] = toUnitFloat(nestedUniformScramble(sobol(index, i), hashCombine(groupSeed, i)));
+    }
+  }
+  return values[dimension++ % SOBOL_GROUP_SIZE];
+}
+
+std::unique_ptr<Sampler> makeSampler(SamplerType type) {
+  if (type == SamplerType::Random)
+    return std::make_unique<RandomSampler>();
+  return std::make_unique<SobolSampler>();
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "../macros.h"
+
+/**
+ * mixBits - scrambles the bits of x so that nearby inputs give unrelated outputs (SplitMix64 finalizer).
+*/
+inline uint64_t mixBits(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+  return x ^ (x >> 31);
+}
+
+/**
+ * class PCG32
+ *
+ * Small permuted congruential generator (PCG-XSH-RR). Unlike std::mt19937 it can be reseeded in a few
+ * instructions, so renders can give every sample its own random sequence.
+ *
+ * private members:
+ *  state - 64 bit LCG state
+ *  inc   - odd increment selecting one of 2^63 independent streams
+*/
+class PCG32 {
+public:
+  using result_type = uint32_t;
+
+  PCG32() {
+    seed(0x853c49e6748fea9bull, 0xda3e39cb94b95bdbull);
+  }
+
+  void seed(uint64_t initState, uint64_t stream) {
+    state = 0;
+    inc = (stream << 1) | 1u;
+    (*this)();
+    state += initState;
+    (*this)();
+  }
+
+  result_type operator()() {
+    uint64_t old = state;
+    state = old * 6364136223846793005ull + inc;
+    uint32_t xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+    uint32_t rot = static_cast<uint32_t>(old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+  }
+
+  static constexpr result_type min() {
+    return 0;
+  }
+
+  static constexpr result_type max() {
+    return std::numeric_limits<result_type>::max();
+  }
+
+private:
+  uint64_t state;
+  uint64_t inc;
+};
+
+enum class SamplerType {
+  Random,
+  Sobol
+};
+
+/**
+ * class Sampler
+ *
+ * Source of the uniform numbers in [0, 1) used to build a camera sample. Every sample is keyed by
+ * (seed, pixel, sample index), and every number drawn for it by a dimension, so the numbers a sample
+ * sees don't depend on which thread, pass, or process takes it. Dimensions are drawn in order starting
+ * at 0, and callers that draw a varying amount per bounce jump to fixed dimensions with setDimension
+ * so that the same dimension always feeds the same decision across the samples of a pixel.
+ *
+ * protected members:
+ *  dimension - dimension of the next number drawn
+*/
+class Sampler {
+public:
+  virtual ~Sampler() {};
+
+  /**
+   * startSample - restarts at dimension 0 of the given sample.
+  */
+  virtual void startSample(uint32_t seed, uint32_t pixel, uint32_t sampleIndex) = 0;
+
+  /**
+   * setDimension - makes dimension the next one drawn.
+  */
+  virtual void setDimension(uint32_t dimension) = 0;
+
+  /**
+   * operator() - the number for the current dimension, moving on to the next one.
+  */
+  virtual float operator()() = 0;
+
+  uint32_t currentDimension() const {
+    return dimension;
+  }
+
+protected:
+  uint32_t dimension = 0;
+};
+
+/**
+ * class RandomSampler
+ *
+ * Independent uniform numbers from a PCG32 stream restarted at every setDimension.
+ *
+ * private members:
+ *  key    - hash of the seed and sample index
+ *  stream - PCG32 stream of the pixel
+ *  rng    - generator positioned at the current dimension
+*/
+class RandomSampler : public Sampler {
+public:
+  void startSample(uint32_t seed, uint32_t pixel, uint32_t sampleIndex);
+  void setDimension(uint32_t dimension);
+  float operator()();
+
+private:
+  uint64_t key = 0;
+  uint64_t stream = 0;
+  PCG32 rng;
+};
+
+/**
+ * class SobolSampler
+ *
+ * Owen-scrambled Sobol points, padded in groups of 4 dimensions. Each group takes the first 4 Sobol
+ * dimensions at a sample index shuffled per pixel and group, so every group is well stratified over the
+ * samples of a pixel while different groups and pixels stay uncorrelated (Burley 2020, "Practical
+ * Hash-based Owen Scrambling").
+ *
+ * private members:
+ *  pixelKey    - hash of the seed and pixel
+ *  sampleIndex - index of the current sample within the pixel
+ *  group       - group whose points are in values, or -1 if none are
+ *  values      - points of the group for the current sample
+*/
+class SobolSampler : public Sampler {
+public:
+  void startSample(uint32_t seed, uint32_t pixel, uint32_t sampleIndex);
+  void setDimension(uint32_t dimension);
+  float operator()();
+
+private:
+  uint64_t pixelKey = 0;
+  uint32_t sampleIndex = 0;
+  int64_t group = -1;
+  std::array<float, 4> values;
+};
+
+/**
+ * makeSampler - allocates a sampler of the given type.
+*/
+std::unique_ptr<Sampler> makeSampler(SamplerType type);
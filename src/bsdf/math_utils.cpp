@@ -20,7 +20,7 @@ Vector3D transformToWorld(float x, float y, float z, const Vector3D &normal) {
   return u * x + v * y + w * z;
 }
 
-Vector3D sampleHemisphere(const Vector3D &n, UniformDistribution &sampler) {
+Vector3D sampleHemisphere(const Vector3D &n, Sampler &sampler) {
   // sample unit hemisphere and map it to the normal
   float rand = sampler();
   float r = std::sqrtf(rand);
@@ -35,7 +35,7 @@ Vector3D sampleHemisphere(const Vector3D &n, UniformDistribution &sampler) {
   return normalized(transformToWorld(x, y, z, n));
 }
 
-Vector3D sphericalToUV(const Vector3D &point, std::shared_ptr<PNG> textureMap) {
+Vector3D sphericalToUV(const Vector3D &point, const std::shared_ptr<Texture> &textureMap) {
   Vector3D normalizedPoint = normalized(point);
   float cosPhi = normalizedPoint.z;
   float phi = std::acos(cosPhi);
@@ -55,6 +55,14 @@ float clamp(float val, float low, float high) {
   return std::max(std::min(val, high), low);
 }
 
+float powerHeuristic(float fPdf, float gPdf) {
+  if (std::isinf(fPdf))
+    return 1.0f;
+  float f2 = fPdf * fPdf;
+  float g2 = gPdf * gPdf;
+  return (f2 + g2 == 0) ? 0.0f : f2 / (f2 + g2);
+}
+
 Vector3D reflect(const Vector3D& incident, const Vector3D& normal) {
   return 2.0f * dot(normal, incident) * normal - incident;
 }
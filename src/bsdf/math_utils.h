@@ -3,24 +3,13 @@
 #include "../macros.h"
 #include "../vector/vector3d.h"
 #include "../image/PNG.h"
+#include "../image/Texture.h"
+#include "Sampler.h"
 
 
-class UniformDistribution {
-public:
-  UniformDistribution(const std::mt19937 &rng, const std::uniform_real_distribution<float> &distribution)
-    : rng(rng), distribution(distribution) {};
-  float operator()() {
-    return distribution(rng);
-  }
-
-private:
-  std::mt19937 rng;
-  std::uniform_real_distribution<float> distribution;
-};
-
 Vector3D transformToWorld(float x, float y, float z, const Vector3D &normal);
 
-Vector3D sampleHemisphere(const Vector3D &n, UniformDistribution &sampler);
+Vector3D sampleHemisphere(const Vector3D &n, Sampler &sampler);
 
 /**
  * sphericalToUV
@@ -29,9 +18,9 @@ Vector3D sampleHemisphere(const Vector3D &n, UniformDistribution &sampler);
  * and maps it to a texture coordinate on the textureMap using longitude and latitude.
  * 
  * point      - point in 3D space
- * textureMap - PNG image to be used as the texture to map into
+ * textureMap - texture to map into
 */
-Vector3D sphericalToUV(const Vector3D &point, std::shared_ptr<PNG> textureMap);
+Vector3D sphericalToUV(const Vector3D &point, const std::shared_ptr<Texture> &textureMap);
 
 /**
  * faceForward
@@ -45,6 +34,14 @@ Vector3D faceForward(const Vector3D &w, const Vector3D &n);
 
 float clamp(float val, float low, float high);
 
+/**
+ * powerHeuristic
+ * 
+ * Multiple importance sampling weight of a sample taken with density fPdf that could
+ * also have been taken with density gPdf. Fold the number of samples of each strategy into the densities.
+*/
+float powerHeuristic(float fPdf, float gPdf);
+
 /**
  * reflect
  * 
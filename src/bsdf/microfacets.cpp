@@ -31,17 +31,17 @@ float TrowbridgeReitzDistribution::lambda(const Vector3D &w, const Vector3D &n)
   return (-1 + std::sqrt(1 + alpha2Tan2Theta)) / 2;
 }
 
-Vector3D TrowbridgeReitzDistribution::sample_wh(const Vector3D &wo, const Vector3D &n, UniformDistribution &sampler) const {
+Vector3D TrowbridgeReitzDistribution::sample_wh(const Vector3D &wo, const Vector3D &n, Sampler &sampler) const {
   float rand = sampler();
   
   float theta = atanf(alpha * sqrtf(rand / (1.0f - rand)));
   float phi = sampler() * 2.0f * M_PI;
 
-  float x = std::sinf(phi) * std::cosf(theta);
-  float y = std::sinf(phi) * std::sinf(theta);
+  float x = std::sinf(theta) * std::cosf(phi);
+  float y = std::sinf(theta) * std::sinf(phi);
 
   // Project z up to the unit hemisphere
-  float z = std::cosf(phi);
+  float z = std::cosf(theta);
 
   return faceForward(normalized(transformToWorld(x, y, z, n)), n);
 }
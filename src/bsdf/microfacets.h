@@ -14,7 +14,7 @@ public:
   float geometry(const Vector3D &wo, const Vector3D &wi, const Vector3D &n) const {
     return 1 / (1 + lambda(wo, n) + lambda(wi, n));
   }
-  virtual Vector3D sample_wh(const Vector3D &wo, const Vector3D &n, UniformDistribution &sampler) const = 0;
+  virtual Vector3D sample_wh(const Vector3D &wo, const Vector3D &n, Sampler &sampler) const = 0;
   float pdf(const Vector3D &wo, const Vector3D &wh, const Vector3D &n) const;
 };
 
@@ -24,7 +24,7 @@ public:
     : alpha(roughnessToAlpha(roughness)) {};
   float distribution(const Vector3D &wh, const Vector3D &n) const;
   float lambda(const Vector3D &w, const Vector3D &n) const;
-  Vector3D sample_wh(const Vector3D &wo, const Vector3D &n, UniformDistribution &sampler) const;
+  Vector3D sample_wh(const Vector3D &wo, const Vector3D &n, Sampler &sampler) const;
   float roughnessToAlpha(const float roughness) const;
 
 private:
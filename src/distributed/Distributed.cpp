@@ -0,0 +1,353 @@
+#include "Distributed.h"
+#include "Socket.h"
+
+#include "../macros.h"
+#include "../parser/parser.h"
+#include "../scene/raytracer.h"
+#include "../image/AccumulationBuffer.h"
+#include "../acceleration/SafeProgressBar.h"
+
+#include <climits>
+#include <cstring>
+#include <deque>
+#include <condition_variable>
+
+// Workers retry for a while so they can be started before the coordinator
+#define CONNECT_ATTEMPTS 50
+#define CONNECT_RETRY_MS 200
+// A worker is treated as lost when a tile takes this many times longer than its pixels are expected to,
+// waiting at least MIN_TILE_TIMEOUT_MS and, before any tile has been timed, FIRST_TILE_TIMEOUT_MS
+#define TILE_TIMEOUT_FACTOR 10
+#define MIN_TILE_TIMEOUT_MS 10000
+#define FIRST_TILE_TIMEOUT_MS 900000
+// A worker is treated as lost when it takes longer than this to load the scene
+#define SCENE_LOAD_TIMEOUT_MS 900000
+
+enum class Message : uint32_t {
+  Scene = 1,  // coordinator -> worker: SceneHeader followed by the scene path
+  Ready,      // worker -> coordinator: scene loaded
+  Tile,       // coordinator -> worker: TileHeader to render
+  Pixels,     // worker -> coordinator: TileHeader followed by the tile's pixels in row-major order
+  Done        // coordinator -> worker: no more tiles
+};
+
+struct SceneHeader {
+  uint32_t seed;
+  int32_t sampleOffset;
+};
+
+struct TileHeader {
+  int32_t id;
+  Tile tile;
+};
+
+static int tileArea(const Tile &tile) {
+  return (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+}
+
+/**
+ * class TileScheduler
+ *
+ * Hands out tiles to the threads serving each worker. Tiles of lost workers are requeued at the
+ * front so the image finishes in roughly the order it was started.
+ *
+ * private members:
+ *  tiles          - every tile of the image
+ *  pending        - ids of tiles that aren't assigned to a worker
+ *  remaining      - number of tiles that haven't been completed
+ *  timedPixels    - pixels of the tiles completed so far
+ *  timedSeconds   - time workers took for those tiles
+*/
+class TileScheduler {
+public:
+  TileScheduler(const std::vector<Tile> &tiles) : tiles(tiles), remaining(tiles.size()) {
+    for (size_t i = 0; i < tiles.size(); ++i) {
+      pending.push_back(i);
+    }
+  }
+
+  /**
+   * next - waits for a tile to render. Returns false once every tile has been completed.
+  */
+  bool next(int &id) {
+    std::unique_lock<std::mutex> lock(m);
+    c.wait(lock, [this]() { return !pending.empty() || remaining == 0; });
+    if (remaining == 0)
+      return false;
+    id = pending.front();
+    pending.pop_front();
+    return true;
+  }
+
+  /**
+   * complete - marks a tile of pixels pixels as done after seconds seconds.
+  */
+  void complete(int pixels, double seconds) {
+    std::lock_guard<std::mutex> lock(m);
+    timedPixels += pixels;
+    timedSeconds += seconds;
+    if (--remaining == 0)
+      c.notify_all();
+  }
+
+  /**
+   * secondsPerPixel - average time workers have taken per pixel, or a negative value before any tile is done.
+  */
+  double secondsPerPixel() const {
+    std::lock_guard<std::mutex> lock(m);
+    return (timedPixels > 0) ? timedSeconds / timedPixels : -1;
+  }
+
+  void requeue(int id) {
+    std::lock_guard<std::mutex> lock(m);
+    pending.push_front(id);
+    c.notify_one();
+  }
+
+  bool finished() const {
+    std::lock_guard<std::mutex> lock(m);
+    return remaining == 0;
+  }
+
+  const Tile &tile(int id) const {
+    return tiles[id];
+  }
+
+private:
+  std::vector<Tile> tiles;
+  std::deque<int> pending;
+  int remaining;
+  int64_t timedPixels = 0;
+  double timedSeconds = 0;
+  mutable std::mutex m;
+  std::condition_variable c;
+};
+
+static std::vector<Tile> splitIntoTiles(int width, int height, int tileSize) {
+  std::vector<Tile> tiles;
+  for (int y = 0; y < height; y += tileSize) {
+    for (int x = 0; x < width; x += tileSize) {
+      tiles.push_back({ x, y, std::min(x + tileSize, width), std::min(y + tileSize, height) });
+    }
+  }
+  return tiles;
+}
+
+/**
+ * serveWorker
+ *
+ * Sends the scene to a newly connected worker and keeps it busy with tiles until there are none left.
+ * If the connection drops, or the worker stalls and takes more than TILE_TIMEOUT_FACTOR times as long as
+ * expected from its earlier tiles (or those of every worker before its first), the tile the worker was
+ * rendering goes back to the scheduler and the connection is dropped. Workers that don't load the scene
+ * within SCENE_LOAD_TIMEOUT_MS are dropped too. The coordinator owns connection, so it can wake the
+ * thread up once the image is finished.
+*/
+static void serveWorker(
+  int workerId,
+  Socket *connectionPtr,
+  const std::vector<char> *sceneMessage,
+  TileScheduler *scheduler,
+  AccumulationBuffer *film,
+  SafeProgressBar *progress
+)
+{
+  Socket &connection = *connectionPtr;
+  uint32_t type;
+  std::vector<char> data;
+  if (!connection.sendMessage(static_cast<uint32_t>(Message::Scene), sceneMessage->data(), sceneMessage->size())
+      || !connection.receiveMessage(type, data, SCENE_LOAD_TIMEOUT_MS) || type != static_cast<uint32_t>(Message::Ready)) {
+    // Workers still loading when the image is finished are cut off on purpose
+    if (!scheduler->finished())
+      std::cerr << "Worker " << workerId << " failed to load the scene." << std::endl;
+    connection.shutdown();
+    return;
+  }
+
+  int id;
+  int64_t workerPixels = 0;
+  double workerSeconds = 0;
+  while (scheduler->next(id)) {
+    const Tile &tile = scheduler->tile(id);
+    TileHeader header{ id, tile };
+    size_t expectedSize = sizeof(TileHeader) + tileArea(tile) * sizeof(AccumulationBuffer::Pixel);
+
+    double secondsPerPixel = (workerPixels > 0) ? workerSeconds / workerPixels : scheduler->secondsPerPixel();
+    int timeoutMs = FIRST_TILE_TIMEOUT_MS;
+    if (secondsPerPixel >= 0)
+      timeoutMs = static_cast<int>(std::min<double>(FIRST_TILE_TIMEOUT_MS, std::max<double>(MIN_TILE_TIMEOUT_MS,
+        TILE_TIMEOUT_FACTOR * 1000 * secondsPerPixel * tileArea(tile))));
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool received = connection.sendMessage(static_cast<uint32_t>(Message::Tile), &header, sizeof(header))
+                 && connection.receiveMessage(type, data, timeoutMs)
+                 && type == static_cast<uint32_t>(Message::Pixels)
+                 && data.size() == expectedSize
+                 && memcmp(data.data(), &header, sizeof(header)) == 0;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    // A reply past the deadline is dropped like a lost connection, so a tile is never completed twice
+    if (!received || elapsed.count() * 1000 > timeoutMs) {
+      std::cerr << "Lost worker " << workerId << ", reassigning tile " << id << "." << std::endl;
+      scheduler->requeue(id);
+      connection.shutdown();
+      return;
+    }
+    workerPixels += tileArea(tile);
+    workerSeconds += elapsed.count();
+
+    // Tiles don't overlap, so workers can write into the film at the same time
+    const char *pixels = data.data() + sizeof(TileHeader);
+    size_t rowBytes = (tile.x1 - tile.x0) * sizeof(AccumulationBuffer::Pixel);
+    for (int y = tile.y0; y < tile.y1; ++y) {
+      memcpy(&film->getPixel(y, tile.x0), pixels, rowBytes);
+      pixels += rowBytes;
+    }
+    scheduler->complete(tileArea(tile), elapsed.count());
+    progress->increment(tileArea(tile));
+  }
+  connection.sendMessage(static_cast<uint32_t>(Message::Done), nullptr, 0);
+}
+
+int runCoordinator(const std::string &address, const std::string &scenePath, int tileSize, int seed, int sampleOffset) {
+  std::signal(SIGPIPE, SIG_IGN);
+
+  std::unique_ptr<Scene> scene = readFromFile(scenePath);
+  if (!scene) {
+    return 1;
+  }
+  if (scene->options.timeBudget > 0 || scene->options.writeInterval > 0) {
+    std::cout << "Distributed renders take numRays samples per pixel in a single pass, ignoring timeBudget and writeInterval." << std::endl;
+  }
+
+  // Workers may be started from other directories
+  char absolutePath[PATH_MAX];
+  if (realpath(scenePath.c_str(), absolutePath) == nullptr) {
+    std::cerr << "Could not resolve the path of " << scenePath << "." << std::endl;
+    return 1;
+  }
+  SceneHeader sceneHeader{ static_cast<uint32_t>(seed), sampleOffset };
+  size_t pathLength = strlen(absolutePath);
+  std::vector<char> sceneMessage(sizeof(sceneHeader) + pathLength);
+  memcpy(sceneMessage.data(), &sceneHeader, sizeof(sceneHeader));
+  memcpy(sceneMessage.data() + sizeof(sceneHeader), absolutePath, pathLength);
+
+  Socket server = Socket::listen(address);
+  if (!server.valid()) {
+    return 1;
+  }
+
+  AccumulationBuffer film(scene->width(), scene->height());
+  film.seed = seed;
+  film.sampleOffset = sampleOffset;
+  film.exposure = scene->options.exposure;
+
+  TileScheduler scheduler(splitIntoTiles(scene->width(), scene->height(), tileSize));
+  int totalPixels = scene->width() * scene->height();
+  std::cout << "Waiting for workers on " << address << " to render " << (scene->width() + tileSize - 1) / tileSize
+            << 'x' << (scene->height() + tileSize - 1) / tileSize << " tiles." << std::endl;
+  SafeProgressBar progress(70, totalPixels, std::max(4096.0, 0.01 * totalPixels));
+
+  std::vector<std::unique_ptr<Socket>> connections;
+  std::vector<std::thread> threads;
+  while (!scheduler.finished()) {
+    if (!server.waitReadable(100))
+      continue;
+    Socket connection = server.accept();
+    if (!connection.valid())
+      continue;
+    connections.push_back(std::make_unique<Socket>(std::move(connection)));
+    threads.emplace_back(serveWorker, threads.size() + 1, connections.back().get(), &sceneMessage, &scheduler, &film, &progress);
+  }
+
+  // Save before waiting on workers that are still loading the scene
+  PNG *img = film.resolve();
+  bool saved = img->saveToFile(scene->filename());
+  delete img;
+
+  // Every tile is back, so the only threads still waiting on a reply are serving workers that are loading
+  // the scene. Waking them up doesn't stop the others from telling their workers they are done.
+  for (std::unique_ptr<Socket> &connection : connections) {
+    connection->shutdownReceive();
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  return saved ? 0 : 1;
+}
+
+int runWorker(const std::string &address, int numThreads) {
+  std::signal(SIGPIPE, SIG_IGN);
+
+  Socket coordinator;
+  for (int attempt = 0; attempt < CONNECT_ATTEMPTS && !coordinator.valid(); ++attempt) {
+    coordinator = Socket::connect(address);
+    if (!coordinator.valid())
+      std::this_thread::sleep_for(std::chrono::milliseconds(CONNECT_RETRY_MS));
+  }
+  if (!coordinator.valid()) {
+    std::cerr << "Could not connect to the coordinator at " << address << "." << std::endl;
+    return 1;
+  }
+
+  uint32_t type;
+  std::vector<char> data;
+  if (!coordinator.receiveMessage(type, data) || type != static_cast<uint32_t>(Message::Scene) || data.size() <= sizeof(SceneHeader)) {
+    std::cerr << "Did not receive a scene from the coordinator." << std::endl;
+    return 1;
+  }
+  SceneHeader sceneHeader;
+  memcpy(&sceneHeader, data.data(), sizeof(sceneHeader));
+  std::string scenePath(data.begin() + sizeof(sceneHeader), data.end());
+
+  std::unique_ptr<Scene> scene = readFromFile(scenePath);
+  if (!scene) {
+    return 1;
+  }
+  // The coordinator decides when the image is finished
+  scene->options.timeBudget = -1;
+  scene->options.writeInterval = -1;
+  scene->options.checkpointFile.clear();
+  if (!scene->prepare(numThreads, sceneHeader.seed)) {
+    return 1;
+  }
+
+  AccumulationBuffer film(scene->width(), scene->height());
+  film.seed = sceneHeader.seed;
+  film.sampleOffset = sceneHeader.sampleOffset;
+  if (!coordinator.sendMessage(static_cast<uint32_t>(Message::Ready), nullptr, 0)) {
+    std::cerr << "Lost connection to the coordinator." << std::endl;
+    return 1;
+  }
+
+  int renderedTiles = 0;
+  while (coordinator.receiveMessage(type, data)) {
+    if (type == static_cast<uint32_t>(Message::Done)) {
+      std::cout << "Rendered " << renderedTiles << " tiles." << std::endl;
+      return 0;
+    }
+
+    TileHeader header;
+    if (type != static_cast<uint32_t>(Message::Tile) || data.size() != sizeof(header))
+      break;
+    memcpy(&header, data.data(), sizeof(header));
+    const Tile &tile = header.tile;
+    if (tile.x0 < 0 || tile.y0 < 0 || tile.x1 > film.width() || tile.y1 > film.height() || tile.x0 >= tile.x1 || tile.y0 >= tile.y1)
+      break;
+
+    scene->renderTile(film, tile, numThreads);
+
+    std::vector<char> reply(sizeof(header) + tileArea(tile) * sizeof(AccumulationBuffer::Pixel));
+    memcpy(reply.data(), &header, sizeof(header));
+    char *pixels = reply.data() + sizeof(header);
+    size_t rowBytes = (tile.x1 - tile.x0) * sizeof(AccumulationBuffer::Pixel);
+    for (int y = tile.y0; y < tile.y1; ++y) {
+      memcpy(pixels, &film.getPixel(y, tile.x0), rowBytes);
+      pixels += rowBytes;
+    }
+    if (!coordinator.sendMessage(static_cast<uint32_t>(Message::Pixels), reply.data(), reply.size()))
+      break;
+    ++renderedTiles;
+  }
+  std::cerr << "Lost connection to the coordinator." << std::endl;
+  return 1;
+}
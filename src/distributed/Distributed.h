@@ -0,0 +1,27 @@
+#pragma once
+
+#include "../macros.h"
+
+/**
+ * runCoordinator
+ *
+ * Splits the image of the scene at scenePath into tiles and hands them out to worker processes that
+ * connect to address, assembling the pixels they send back into the scene's output file. Tiles held
+ * by a worker whose connection is lost go back to the queue for the remaining workers.
+ * Returns the process exit code.
+ *
+ * address      - "unix:path" or "[host]:port" to listen on
+ * scenePath    - scene file, which must be readable by the workers at the same path
+ * tileSize     - width and height of the tiles in pixels
+ * seed         - seed the samples are drawn with
+ * sampleOffset - index of the first sample taken at each pixel
+*/
+int runCoordinator(const std::string &address, const std::string &scenePath, int tileSize, int seed, int sampleOffset);
+
+/**
+ * runWorker
+ *
+ * Connects to the coordinator at address, loads the scene it names once, and renders the tiles it
+ * is given on numThreads threads until the coordinator has no more work. Returns the process exit code.
+*/
+int runWorker(const std::string &address, int numThreads);
@@ -0,0 +1,239 @@
+#include "Socket.h"
+
+#include "../macros.h"
+
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define UNIX_PREFIX "unix:"
+// Guards against allocating garbage lengths read from a broken connection
+#define MAX_MESSAGE_SIZE (1u << 30)
+
+struct MessageHeader {
+  uint32_t type;
+  uint32_t size;
+};
+
+static bool isUnixAddress(const std::string &address) {
+  return address.compare(0, strlen(UNIX_PREFIX), UNIX_PREFIX) == 0;
+}
+
+static bool makeUnixAddress(const std::string &address, sockaddr_un &addr) {
+  std::string path = address.substr(strlen(UNIX_PREFIX));
+  if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Invalid Unix socket path " << path << "." << std::endl;
+    return false;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  return true;
+}
+
+static addrinfo *resolveTCPAddress(const std::string &address, bool passive) {
+  size_t colon = address.rfind(':');
+  std::string host = (colon == std::string::npos) ? "" : address.substr(0, colon);
+  std::string port = (colon == std::string::npos) ? address : address.substr(colon + 1);
+  if (!passive && host.empty())
+    host = "localhost";
+
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+  addrinfo *result = nullptr;
+  int error = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result);
+  if (error != 0) {
+    std::cerr << "Could not resolve " << address << ": " << gai_strerror(error) << std::endl;
+    return nullptr;
+  }
+  return result;
+}
+
+static void configureTCP(int fd) {
+  // Tiles are requested one at a time, so don't let small messages wait on Nagle's algorithm
+  int enable = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+  setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
+}
+
+Socket::~Socket() {
+  close();
+}
+
+Socket::Socket(Socket &&other) : fd_(other.fd_), path_(std::move(other.path_)) {
+  other.fd_ = -1;
+  other.path_.clear();
+}
+
+Socket &Socket::operator=(Socket &&other) {
+  if (this != &other) {
+    close();
+    fd_ = other.fd_;
+    path_ = std::move(other.path_);
+    other.fd_ = -1;
+    other.path_.clear();
+  }
+  return *this;
+}
+
+Socket Socket::listen(const std::string &address) {
+  if (isUnixAddress(address)) {
+    sockaddr_un addr;
+    if (!makeUnixAddress(address, addr))
+      return Socket();
+
+    Socket sock(::socket(AF_UNIX, SOCK_STREAM, 0));
+    // A socket file left behind by an earlier run would make bind fail
+    unlink(addr.sun_path);
+    if (!sock.valid() || bind(sock.fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || ::listen(sock.fd_, SOMAXCONN) != 0) {
+      std::cerr << "Could not listen on " << address << ": " << strerror(errno) << std::endl;
+      return Socket();
+    }
+    sock.path_ = addr.sun_path;
+    return sock;
+  }
+
+  addrinfo *addresses = resolveTCPAddress(address, true);
+  for (addrinfo *info = addresses; info != nullptr; info = info->ai_next) {
+    Socket sock(::socket(info->ai_family, info->ai_socktype, info->ai_protocol));
+    if (!sock.valid())
+      continue;
+
+    int enable = 1;
+    setsockopt(sock.fd_, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    if (bind(sock.fd_, info->ai_addr, info->ai_addrlen) == 0 && ::listen(sock.fd_, SOMAXCONN) == 0) {
+      freeaddrinfo(addresses);
+      return sock;
+    }
+  }
+  std::cerr << "Could not listen on " << address << ": " << strerror(errno) << std::endl;
+  if (addresses != nullptr)
+    freeaddrinfo(addresses);
+  return Socket();
+}
+
+Socket Socket::connect(const std::string &address) {
+  if (isUnixAddress(address)) {
+    sockaddr_un addr;
+    if (!makeUnixAddress(address, addr))
+      return Socket();
+
+    Socket sock(::socket(AF_UNIX, SOCK_STREAM, 0));
+    if (!sock.valid() || ::connect(sock.fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+      return Socket();
+    return sock;
+  }
+
+  addrinfo *addresses = resolveTCPAddress(address, false);
+  for (addrinfo *info = addresses; info != nullptr; info = info->ai_next) {
+    Socket sock(::socket(info->ai_family, info->ai_socktype, info->ai_protocol));
+    if (sock.valid() && ::connect(sock.fd_, info->ai_addr, info->ai_addrlen) == 0) {
+      configureTCP(sock.fd_);
+      freeaddrinfo(addresses);
+      return sock;
+    }
+  }
+  if (addresses != nullptr)
+    freeaddrinfo(addresses);
+  return Socket();
+}
+
+Socket Socket::accept() const {
+  int fd = ::accept(fd_, nullptr, nullptr);
+  if (fd < 0)
+    return Socket();
+
+  sockaddr_storage addr;
+  socklen_t length = sizeof(addr);
+  if (getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &length) == 0 && addr.ss_family != AF_UNIX)
+    configureTCP(fd);
+  return Socket(fd);
+}
+
+bool Socket::waitReadable(int timeoutMs) const {
+  pollfd request{ fd_, POLLIN, 0 };
+  return poll(&request, 1, timeoutMs) > 0 && (request.revents & POLLIN);
+}
+
+bool Socket::sendMessage(uint32_t type, const void *data, size_t size) {
+  if (size > MAX_MESSAGE_SIZE)
+    return false;
+
+  MessageHeader header{ type, static_cast<uint32_t>(size) };
+  return sendAll(&header, sizeof(header)) && sendAll(data, size);
+}
+
+bool Socket::receiveMessage(uint32_t &type, std::vector<char> &data, int timeoutMs) {
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(timeoutMs, 0));
+  bool hasDeadline = timeoutMs >= 0;
+  MessageHeader header;
+  if (!receiveAll(&header, sizeof(header), deadline, hasDeadline) || header.size > MAX_MESSAGE_SIZE)
+    return false;
+
+  type = header.type;
+  data.resize(header.size);
+  return receiveAll(data.data(), data.size(), deadline, hasDeadline);
+}
+
+void Socket::shutdown() {
+  if (valid())
+    ::shutdown(fd_, SHUT_RDWR);
+}
+
+void Socket::shutdownReceive() {
+  if (valid())
+    ::shutdown(fd_, SHUT_RD);
+}
+
+void Socket::close() {
+  if (valid()) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+  if (!path_.empty()) {
+    unlink(path_.c_str());
+    path_.clear();
+  }
+}
+
+bool Socket::sendAll(const void *data, size_t size) {
+  const char *bytes = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t sent = ::send(fd_, bytes, size, 0);
+    if (sent < 0 && errno == EINTR)
+      continue;
+    if (sent <= 0)
+      return false;
+    bytes += sent;
+    size -= sent;
+  }
+  return true;
+}
+
+bool Socket::receiveAll(void *data, size_t size, std::chrono::steady_clock::time_point deadline, bool hasDeadline) {
+  char *bytes = static_cast<char *>(data);
+  while (size > 0) {
+    if (hasDeadline) {
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+      if (remaining.count() <= 0 || !waitReadable(static_cast<int>(remaining.count())))
+        return false;
+    }
+    ssize_t received = ::recv(fd_, bytes, size, 0);
+    if (received < 0 && errno == EINTR)
+      continue;
+    if (received <= 0)
+      return false;
+    bytes += received;
+    size -= received;
+  }
+  return true;
+}
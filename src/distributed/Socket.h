@@ -0,0 +1,83 @@
+#pragma once
+
+#include "../macros.h"
+
+/**
+ * class Socket
+ *
+ * Owns a stream socket and exchanges length-prefixed messages over it. Addresses are either
+ * "unix:path" for a Unix domain socket or "host:port" for TCP, where the host may be left out
+ * when listening to accept connections on every interface.
+ *
+ * Messages are sent in native byte order, so every machine taking part in a render must share it.
+ *
+ * private members:
+ *  fd_   - file descriptor of the socket, or -1 if it is closed
+ *  path_ - socket file of a listening Unix domain socket, removed when the socket is closed
+*/
+class Socket {
+public:
+  Socket() : fd_(-1) {};
+  explicit Socket(int fd) : fd_(fd) {};
+  ~Socket();
+
+  Socket(const Socket &other) = delete;
+  Socket &operator=(const Socket &other) = delete;
+  Socket(Socket &&other);
+  Socket &operator=(Socket &&other);
+
+  /**
+   * listen - opens a socket accepting connections on address. Returns a closed socket on failure.
+  */
+  static Socket listen(const std::string &address);
+
+  /**
+   * connect - connects to a socket listening on address. Returns a closed socket on failure.
+  */
+  static Socket connect(const std::string &address);
+
+  /**
+   * accept - waits for the next connection to a listening socket.
+  */
+  Socket accept() const;
+
+  /**
+   * waitReadable - whether data or a connection arrives within timeoutMs milliseconds.
+  */
+  bool waitReadable(int timeoutMs) const;
+
+  /**
+   * sendMessage - sends a message of the given type with size bytes of data.
+  */
+  bool sendMessage(uint32_t type, const void *data, size_t size);
+
+  /**
+   * receiveMessage - waits for the next message and fills in its type and data. Fails if the whole
+   * message hasn't arrived within timeoutMs milliseconds, or waits as long as it takes if timeoutMs is negative.
+  */
+  bool receiveMessage(uint32_t &type, std::vector<char> &data, int timeoutMs=-1);
+
+  /**
+   * shutdown - wakes up any thread blocked on the socket and makes further transfers fail.
+  */
+  void shutdown();
+
+  /**
+   * shutdownReceive - wakes up any thread blocked receiving from the socket and makes further receives
+   * fail, while sends still go through.
+  */
+  void shutdownReceive();
+
+  void close();
+
+  bool valid() const {
+    return fd_ >= 0;
+  }
+
+private:
+  bool sendAll(const void *data, size_t size);
+  bool receiveAll(void *data, size_t size, std::chrono::steady_clock::time_point deadline, bool hasDeadline);
+
+  int fd_;
+  std::string path_;
+};
@@ -0,0 +1,192 @@
+#include "AccumulationBuffer.h"
+
+#include "../macros.h"
+
+#include <cstdio>
+
+#define MIN_ERROR_LUMINANCE 0.05f
+
+// Accumulation files start with this magic number and version, followed by the header fields and
+// the raw Pixel structs in row-major order, all in native byte order
+static const char ACCUMULATION_MAGIC[8] = { 'R', 'T', 'A', 'C', 'C', 'U', 'M', '1' };
+
+struct AccumulationHeader {
+  int32_t width;
+  int32_t height;
+  uint32_t seed;
+  int32_t sampleOffset;
+  float exposure;
+};
+
+void AccumulationBuffer::Pixel::add(RGBAColor color) {
+  ++samples;
+  if (hasNaN(color) || color.a == 0)
+    return;
+
+  float y = ::luminance(color);
+  r += color.r;
+  g += color.g;
+  b += color.b;
+  luminance += y;
+  luminanceSquared += y * y;
+  ++hits;
+}
+
+RGBAColor AccumulationBuffer::Pixel::resolve() const {
+  if (hits == 0)
+    return RGBAColor(0, 0, 0, 0);
+
+  float invHits = 1.0f / hits;
+  return RGBAColor(r * invHits, g * invHits, b * invHits, static_cast<float>(hits) / samples);
+}
+
+float AccumulationBuffer::Pixel::error() const {
+  if (samples < 2)
+    return INF_D;
+
+  // Samples that missed count as black
+  float invSamples = 1.0f / samples;
+  float mean = luminance * invSamples;
+  float variance = std::max(0.0f, luminanceSquared * invSamples - mean * mean) * samples / (samples - 1);
+  return std::sqrt(variance * invSamples) / std::max(mean, MIN_ERROR_LUMINANCE);
+}
+
+AccumulationBuffer::Pixel &AccumulationBuffer::getPixel(unsigned row, unsigned col) {
+  assert(row < static_cast<unsigned>(height_));
+  assert(col < static_cast<unsigned>(width_));
+
+  return pixels_[row * width_ + col];
+}
+
+const AccumulationBuffer::Pixel &AccumulationBuffer::getPixel(unsigned row, unsigned col) const {
+  assert(row < static_cast<unsigned>(height_));
+  assert(col < static_cast<unsigned>(width_));
+
+  return pixels_[row * width_ + col];
+}
+
+void AccumulationBuffer::merge(const AccumulationBuffer &other) {
+  assert(width_ == other.width_ && height_ == other.height_);
+
+  for (size_t i = 0; i < pixels_.size(); ++i) {
+    Pixel &pixel = pixels_[i];
+    const Pixel &otherPixel = other.pixels_[i];
+    pixel.r += otherPixel.r;
+    pixel.g += otherPixel.g;
+    pixel.b += otherPixel.b;
+    pixel.luminance += otherPixel.luminance;
+    pixel.luminanceSquared += otherPixel.luminanceSquared;
+    pixel.hits += otherPixel.hits;
+    pixel.samples += otherPixel.samples;
+  }
+}
+
+int AccumulationBuffer::minSamples() const {
+  int samples = std::numeric_limits<int>::max();
+  for (const Pixel &pixel : pixels_) {
+    samples = std::min(samples, pixel.samples);
+  }
+  return pixels_.empty() ? 0 : samples;
+}
+
+int AccumulationBuffer::maxSamples() const {
+  int samples = 0;
+  for (const Pixel &pixel : pixels_) {
+    samples = std::max(samples, pixel.samples);
+  }
+  return samples;
+}
+
+double AccumulationBuffer::averageSamples() const {
+  long long totalSamples = 0;
+  for (const Pixel &pixel : pixels_) {
+    totalSamples += pixel.samples;
+  }
+  return pixels_.empty() ? 0 : static_cast<double>(totalSamples) / pixels_.size();
+}
+
+PNG *AccumulationBuffer::resolve() const {
+  PNG *img = new PNG(width_, height_);
+  for (int y = 0; y < height_; ++y) {
+    for (int x = 0; x < width_; ++x) {
+      RGBAColor &pixel = img->getPixel(y, x);
+      pixel = clipColor(getPixel(y, x).resolve());
+      if (exposure >= 0) {
+        pixel.r = exponentialExposure(pixel.r, exposure);
+        pixel.g = exponentialExposure(pixel.g, exposure);
+        pixel.b = exponentialExposure(pixel.b, exposure);
+      }
+    }
+  }
+  return img;
+}
+
+PNG *AccumulationBuffer::sampleMap(int maxSamples) const {
+  PNG *img = new PNG(width_, height_);
+  float invMaxSamples = 1.0f / std::max(1, maxSamples);
+  for (int y = 0; y < height_; ++y) {
+    for (int x = 0; x < width_; ++x) {
+      // Stored in linear space, so undo the gamma applied when saving to keep the map proportional
+      float value = gammaToLinear(std::min(1.0f, getPixel(y, x).samples * invMaxSamples));
+      img->getPixel(y, x) = RGBAColor(value, value, value, 1);
+    }
+  }
+  return img;
+}
+
+bool AccumulationBuffer::saveToFile(const std::string &filename) const {
+  std::string tempFilename = filename + ".tmp";
+  std::ofstream file(tempFilename, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    std::cerr << "Could not open accumulation file " << tempFilename << " for writing." << std::endl;
+    return false;
+  }
+
+  AccumulationHeader header{ width_, height_, seed, sampleOffset, exposure };
+  file.write(ACCUMULATION_MAGIC, sizeof(ACCUMULATION_MAGIC));
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char *>(pixels_.data()), pixels_.size() * sizeof(Pixel));
+  file.close();
+  if (!file) {
+    std::cerr << "Failed to write accumulation file " << tempFilename << "." << std::endl;
+    return false;
+  }
+
+  if (std::rename(tempFilename.c_str(), filename.c_str()) != 0) {
+    std::cerr << "Could not replace accumulation file " << filename << "." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool AccumulationBuffer::readFromFile(const std::string &filename) {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) {
+    std::cerr << "Could not open accumulation file " << filename << "." << std::endl;
+    return false;
+  }
+
+  char magic[sizeof(ACCUMULATION_MAGIC)];
+  AccumulationHeader header;
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!file || !std::equal(magic, magic + sizeof(magic), ACCUMULATION_MAGIC) || header.width <= 0 || header.height <= 0) {
+    std::cerr << filename << " is not an accumulation file." << std::endl;
+    return false;
+  }
+
+  std::vector<Pixel> pixels(static_cast<size_t>(header.width) * header.height);
+  file.read(reinterpret_cast<char *>(pixels.data()), pixels.size() * sizeof(Pixel));
+  if (!file) {
+    std::cerr << "Accumulation file " << filename << " is truncated." << std::endl;
+    return false;
+  }
+
+  width_ = header.width;
+  height_ = header.height;
+  seed = header.seed;
+  sampleOffset = header.sampleOffset;
+  exposure = header.exposure;
+  pixels_ = std::move(pixels);
+  return true;
+}
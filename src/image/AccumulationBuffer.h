@@ -0,0 +1,124 @@
+#pragma once
+
+#include "PNG.h"
+
+#include "../macros.h"
+
+/**
+ * class AccumulationBuffer
+ *
+ * Float running sums of the samples taken for every pixel, so samples can be added to a
+ * pixel at any time and the image resolved from the current estimate. Buffers can be saved
+ * to and loaded from accumulation files to resume or merge renders.
+ *
+ * public members:
+ *  seed         - seed the samples were drawn with
+ *  sampleOffset - index of the first sample taken at each pixel, so runs can cover disjoint sample ranges
+ *  exposure     - exposure applied when resolving, or negative for none
+ *
+ * private members:
+ *  width_  - width in pixels
+ *  height_ - height in pixels
+ *  pixels_ - row-major pixel sums
+*/
+class AccumulationBuffer {
+public:
+  /**
+   * Pixel struct
+   *
+   * r, g, b          - sum of the sample colors
+   * luminance        - sum of the sample luminances
+   * luminanceSquared - sum of the squared sample luminances
+   * hits             - number of samples that produced a color
+   * samples          - number of samples taken
+  */
+  struct Pixel {
+    float r = 0;
+    float g = 0;
+    float b = 0;
+    float luminance = 0;
+    float luminanceSquared = 0;
+    int hits = 0;
+    int samples = 0;
+
+    /**
+     * add - adds a sample. Samples with no color (alpha of 0) or NaNs only count towards samples.
+    */
+    void add(RGBAColor color);
+
+    /**
+     * resolve - average color of the hits, with alpha set to the fraction of samples that hit.
+    */
+    RGBAColor resolve() const;
+
+    /**
+     * error
+     *
+     * Standard error of the mean luminance relative to the mean, with the mean floored so that
+     * dark pixels don't chase noise that is invisible once exposed.
+    */
+    float error() const;
+  };
+
+  AccumulationBuffer(int width, int height)
+    : width_(width), height_(height), pixels_(width * height) {};
+
+  Pixel &getPixel(unsigned row, unsigned col);
+  const Pixel &getPixel(unsigned row, unsigned col) const;
+
+  int width() const {
+    return width_;
+  }
+
+  int height() const {
+    return height_;
+  }
+
+  /**
+   * merge - adds the samples of other, which must have the same size, to this buffer.
+  */
+  void merge(const AccumulationBuffer &other);
+
+  /**
+   * minSamples, maxSamples - fewest and most samples taken at any pixel.
+  */
+  int minSamples() const;
+  int maxSamples() const;
+
+  /**
+   * averageSamples - mean number of samples taken per pixel.
+  */
+  double averageSamples() const;
+
+  /**
+   * resolve - the current estimate of the image, clipped to [0, 1] and exposed.
+  */
+  PNG *resolve() const;
+
+  /**
+   * sampleMap - grayscale image of the samples taken at each pixel, with white at maxSamples.
+  */
+  PNG *sampleMap(int maxSamples) const;
+
+  /**
+   * saveToFile
+   *
+   * Writes the buffer to an accumulation file. The file is written under a temporary name and
+   * renamed into place, so an interrupted write never destroys the previous file.
+  */
+  bool saveToFile(const std::string &filename) const;
+
+  /**
+   * readFromFile - replaces the buffer with the contents of an accumulation file.
+  */
+  bool readFromFile(const std::string &filename);
+
+  uint32_t seed = 0;
+  int sampleOffset = 0;
+  float exposure = -1;
+
+private:
+  int width_;
+  int height_;
+  std::vector<Pixel> pixels_;
+};
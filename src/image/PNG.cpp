@@ -162,4 +162,8 @@ bool PNG::saveToFile(const std::string& filename) {
   }
   delete[] byteData;
   return (error == 0);
-}
\ No newline at end of file
+}
+
+float luminance(const RGBAColor& c) {
+  return 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b;
+}
@@ -41,11 +41,13 @@ RGBAColor operator*(const RGBAColor& c, const Vector3D& v);
 
 class PNG {
 public:
+  PNG() : width_(0), height_(0), image_(nullptr) {};
+
   PNG(unsigned w, unsigned h) : width_(w), height_(h) {
     image_ = new RGBAColor[width_ * height_];
   }
 
-  PNG(const std::string &filename) {
+  PNG(const std::string &filename) : image_(nullptr) {
     readFromFile(filename);
   }
 
@@ -81,4 +83,9 @@ float gammaToLinear(float channel);
 
 float exponentialExposure(float channel, float exposure);
 
-RGBAColor clipColor(const RGBAColor& c);
\ No newline at end of file
+RGBAColor clipColor(const RGBAColor& c);
+
+/**
+ * luminance - perceived brightness of a linear color using the Rec. 709 weights.
+*/
+float luminance(const RGBAColor& c);
\ No newline at end of file
@@ -0,0 +1,123 @@
+#include "lodepng.h"
+#include "Texture.h"
+
+#include "../macros.h"
+
+// Linear value of every 8-bit sRGB channel value
+static const std::array<float, 256> SRGBToLinear = []() {
+  std::array<float, 256> table;
+  for (int i = 0; i < 256; ++i) {
+    table[i] = gammaToLinear(i / 255.0f);
+  }
+  return table;
+}();
+
+// Spread the low 3 bits of x out to every other bit
+static inline unsigned interleave3(unsigned x) {
+  x = (x | (x << 2)) & 0x33;
+  x = (x | (x << 1)) & 0x55;
+  return x;
+}
+
+static inline size_t texelIndex(const Texture::MipLevel &level, unsigned row, unsigned col) {
+  size_t tile = (row / TEXTURE_TILE_SIZE) * level.tilesPerRow + col / TEXTURE_TILE_SIZE;
+  unsigned offset = interleave3(col % TEXTURE_TILE_SIZE) | (interleave3(row % TEXTURE_TILE_SIZE) << 1);
+  return tile * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE + offset;
+}
+
+static inline uint8_t linearToByte(float channel) {
+  return static_cast<uint8_t>(std::round(std::min(1.0f, std::max(0.0f, linearToGamma(channel))) * 255));
+}
+
+RGBAColor Texture::getPixel(unsigned row, unsigned col, float footprint) const {
+  assert(row >= 0 && row < static_cast<unsigned>(height()));
+  assert(col >= 0 && col < static_cast<unsigned>(width()));
+
+  // Each level halves the resolution, so the level whose texels best match the footprint is log2(footprint)
+  int numLevels = levels_.size();
+  int mip = footprint > 1.0f ? std::min(std::ilogb(footprint), numLevels - 1) : 0;
+  const MipLevel &level = levels_[mip];
+  row = std::min(row >> mip, level.height - 1);
+  col = std::min(col >> mip, level.width - 1);
+
+  const Texel &texel = level.texels[texelIndex(level, row, col)];
+  return RGBAColor(SRGBToLinear[texel.r], SRGBToLinear[texel.g], SRGBToLinear[texel.b], texel.a / 255.0f);
+}
+
+size_t Texture::memoryUsage() const {
+  size_t bytes = 0;
+  for (const MipLevel &level : levels_) {
+    bytes += level.texels.size() * sizeof(Texel);
+  }
+  return bytes;
+}
+
+void Texture::allocateLevel(MipLevel &level, unsigned width, unsigned height) {
+  level.width = width;
+  level.height = height;
+  level.tilesPerRow = (width + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+  unsigned tilesPerColumn = (height + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+  level.texels.assign(level.tilesPerRow * tilesPerColumn * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE, Texel{ 0, 0, 0, 0 });
+}
+
+void Texture::buildMipLevels() {
+  while (levels_.back().width > 1 || levels_.back().height > 1) {
+    levels_.emplace_back();
+    const MipLevel &parent = levels_[levels_.size() - 2];
+    MipLevel &level = levels_.back();
+    allocateLevel(level, std::max(1u, parent.width / 2), std::max(1u, parent.height / 2));
+
+    // Average each 2x2 block of the parent level in linear space
+    for (unsigned row = 0; row < level.height; ++row) {
+      for (unsigned col = 0; col < level.width; ++col) {
+        float r = 0, g = 0, b = 0, a = 0;
+        for (unsigned dy = 0; dy < 2; ++dy) {
+          for (unsigned dx = 0; dx < 2; ++dx) {
+            unsigned parentRow = std::min(2 * row + dy, parent.height - 1);
+            unsigned parentCol = std::min(2 * col + dx, parent.width - 1);
+            const Texel &texel = parent.texels[texelIndex(parent, parentRow, parentCol)];
+            r += SRGBToLinear[texel.r];
+            g += SRGBToLinear[texel.g];
+            b += SRGBToLinear[texel.b];
+            a += texel.a;
+          }
+        }
+        level.texels[texelIndex(level, row, col)] = Texel{
+          linearToByte(r * 0.25f),
+          linearToByte(g * 0.25f),
+          linearToByte(b * 0.25f),
+          static_cast<uint8_t>(std::round(a * 0.25f))
+        };
+      }
+    }
+  }
+}
+
+bool Texture::readFromFile(const std::string &filename) {
+  std::vector<unsigned char> byteData;
+  unsigned width;
+  unsigned height;
+  unsigned error = lodepng::decode(byteData, width, height, filename);
+
+  if (error) {
+    std::cerr << "PNG decoder error " << error << ": " << lodepng_error_text(error) << std::endl;
+    return false;
+  }
+
+  levels_.clear();
+  levels_.emplace_back();
+  MipLevel &level = levels_.back();
+  allocateLevel(level, width, height);
+
+  for (unsigned row = 0; row < height; ++row) {
+    for (unsigned col = 0; col < width; ++col) {
+      const unsigned char *pixel = &byteData[(row * width + col) * 4];
+      level.texels[texelIndex(level, row, col)] = Texel{ pixel[0], pixel[1], pixel[2], pixel[3] };
+    }
+  }
+  buildMipLevels();
+
+  std::cout << "Loaded texture " << filename << " (" << width << 'x' << height << ", " << levels_.size() << " mip levels) using "
+            << std::fixed << std::setprecision(2) << memoryUsage() / (1024.0 * 1024.0) << " MB" << std::endl;
+  return true;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "PNG.h"
+
+#include "../macros.h"
+
+#define TEXTURE_TILE_SIZE 8
+
+/**
+ * class Texture
+ *
+ * Read-only image used for texture and luminance map lookups.
+ *
+ * Texels are kept as 8-bit sRGB and converted to linear color through a lookup table when read,
+ * which takes a quarter of the memory of a float PNG and skips converting every texel at load time.
+ * Texels are grouped into 8x8 tiles stored in Morton order, so neighboring lookups in either
+ * direction land on the same few cache lines.
+ *
+ * A mip pyramid is built at load time, each level a 2x2 box filtered copy of the one before it.
+ * Lookups pass the footprint of the ray in texels and read from the matching level, so distant
+ * surfaces read from small, cache friendly levels instead of aliasing across the full image.
+ *
+ * private members:
+ *  levels_ - mip levels, from the full resolution image down to a single texel
+*/
+class Texture {
+public:
+  struct Texel {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+    uint8_t a;
+  };
+
+  /**
+   * MipLevel struct
+   *
+   * width       - width in texels
+   * height      - height in texels
+   * tilesPerRow - number of tiles needed to cover a row of texels
+   * texels      - tiled texel storage, padded to whole tiles
+  */
+  struct MipLevel {
+    unsigned width;
+    unsigned height;
+    unsigned tilesPerRow;
+    std::vector<Texel> texels;
+  };
+
+  bool readFromFile(const std::string &filename);
+
+  /**
+   * getPixel
+   *
+   * Returns the linear color of the texel at (row, col) of the full resolution image.
+   *
+   * footprint - width of the ray footprint in full resolution texels; picks the mip level to read
+  */
+  RGBAColor getPixel(unsigned row, unsigned col, float footprint=0.0f) const;
+
+  int width() const {
+    return levels_.empty() ? 0 : levels_[0].width;
+  }
+
+  int height() const {
+    return levels_.empty() ? 0 : levels_[0].height;
+  }
+
+  /**
+   * memoryUsage - number of bytes used to store the texels of every mip level.
+  */
+  size_t memoryUsage() const;
+
+private:
+  void allocateLevel(MipLevel &level, unsigned width, unsigned height);
+  void buildMipLevels();
+
+  std::vector<MipLevel> levels_;
+};
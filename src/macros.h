@@ -2,7 +2,10 @@
 
 #include <limits>
 #include <vector>
+#include <array>
+#include <cstdint>
 #include <queue>
+#include <deque>
 #include <functional>
 #include <iostream>
 #include <stack>
@@ -24,13 +27,21 @@
 #include <chrono>
 #include <ctime>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <csignal>
 #include <unordered_map>
 #include <cctype>
+#include <numeric>
 #include <locale>
+#include <bitset>
+#include <new>
+#include <cstring>
 
 #define DEBUG
 // #define PROFILE_RAYTRACE
 // #define PROFILE_INTERSECT
+// #define PROFILE_LAYOUT
 
 #define INF_D std::numeric_limits<float>::infinity()
 #define ONE_THIRD 1.0 / 3.0
@@ -1,35 +1,180 @@
 #include "macros.h"
 
+#include <getopt.h>
+
 #include "vector/vector3d.h"
 #include "parser/parser.h"
 #include "scene/raytracer.h"
+#include "acceleration/Arena.h"
 #include "acceleration/Profiler.h"
+#include "distributed/Distributed.h"
 
-int main(int argc, char **argv) {
-  if (argc > 3) {
-    std::cerr << "usage: " << argv[0] << " [-t numThreads] filepath" << std::endl;
-    return 1;
+static void printUsage(const char *program) {
+  std::cerr << "usage: " << program << " [-t numThreads] [--time-budget seconds] [--write-interval seconds]"
+            << " [--checkpoint file | --resume file] [--seed n] [--sample-offset n] [--huge-pages] filepath" << std::endl;
+  std::cerr << "       " << program << " --merge output accumulationFile..." << std::endl;
+  std::cerr << "       " << program << " --coordinator address [--tile-size n] [--seed n] [--sample-offset n] filepath" << std::endl;
+  std::cerr << "       " << program << " [-t numThreads] --worker address" << std::endl;
+}
+
+/**
+ * mergeAccumulationFiles
+ *
+ * Sums accumulation files from independent runs into output, which is written as an image if it ends in .png
+ * and as an accumulation file otherwise. Runs that share a seed must have rendered disjoint sample ranges.
+*/
+static int mergeAccumulationFiles(const std::string &output, char **files, int numFiles) {
+  AccumulationBuffer merged(0, 0);
+  std::vector<std::pair<uint32_t, std::pair<int, int>>> ranges;
+  for (int i = 0; i < numFiles; ++i) {
+    AccumulationBuffer film(0, 0);
+    if (!film.readFromFile(files[i]))
+      return 1;
+
+    std::pair<int, int> range = { film.sampleOffset, film.sampleOffset + film.maxSamples() };
+    for (const auto &other : ranges) {
+      if (other.first == film.seed && range.first < other.second.second && other.second.first < range.second) {
+        std::cerr << files[i] << " repeats samples " << std::max(range.first, other.second.first) << " to "
+                  << std::min(range.second, other.second.second) << " of another file with seed " << film.seed
+                  << ". Render with a different seed or --sample-offset." << std::endl;
+        return 1;
+      }
+    }
+    ranges.push_back({ film.seed, range });
+
+    if (i == 0) {
+      merged = std::move(film);
+    } else if (film.width() != merged.width() || film.height() != merged.height()) {
+      std::cerr << files[i] << " is " << film.width() << 'x' << film.height() << " but "
+                << files[0] << " is " << merged.width() << 'x' << merged.height() << "." << std::endl;
+      return 1;
+    } else {
+      merged.merge(film);
+      merged.sampleOffset = std::min(merged.sampleOffset, film.sampleOffset);
+    }
   }
 
+  std::cout << "Merged " << numFiles << " accumulation files with " << std::fixed << std::setprecision(2)
+            << merged.averageSamples() << " samples per pixel." << std::endl;
+
+  bool isImage = output.size() >= 4 && output.compare(output.size() - 4, 4, ".png") == 0;
+  if (!isImage)
+    return merged.saveToFile(output) ? 0 : 1;
+
+  PNG *img = merged.resolve();
+  bool saved = img->saveToFile(output);
+  delete img;
+  return saved ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  static const struct option longOptions[] = {
+    { "time-budget",    required_argument, nullptr, 'b' },
+    { "write-interval", required_argument, nullptr, 'w' },
+    { "checkpoint",     required_argument, nullptr, 'c' },
+    { "resume",         required_argument, nullptr, 'r' },
+    { "seed",           required_argument, nullptr, 'S' },
+    { "sample-offset",  required_argument, nullptr, 'o' },
+    { "merge",          required_argument, nullptr, 'm' },
+    { "coordinator",    required_argument, nullptr, 'C' },
+    { "worker",         required_argument, nullptr, 'W' },
+    { "tile-size",      required_argument, nullptr, 's' },
+    { "huge-pages",     no_argument,       nullptr, 'H' },
+    { nullptr,          0,                 nullptr, 0 }
+  };
+
   int opt;
   int numThreads = 4;
-  while ((opt = getopt(argc, argv, "t:")) != -1) {
+  float timeBudget = -1;
+  float writeInterval = -1;
+  std::string checkpointFile;
+  bool resume = false;
+  int seed = 56;
+  int sampleOffset = 0;
+  std::string mergeOutput;
+  std::string coordinatorAddress;
+  std::string workerAddress;
+  int tileSize = 32;
+  while ((opt = getopt_long(argc, argv, "t:", longOptions, nullptr)) != -1) {
     switch (opt) {
       case 't':
         numThreads = atoi(optarg);
         break;
+      case 'b':
+        timeBudget = atof(optarg);
+        break;
+      case 'w':
+        writeInterval = atof(optarg);
+        break;
+      case 'c':
+        checkpointFile = optarg;
+        break;
+      case 'r':
+        checkpointFile = optarg;
+        resume = true;
+        break;
+      case 'S':
+        seed = atoi(optarg);
+        break;
+      case 'o':
+        sampleOffset = atoi(optarg);
+        break;
+      case 'm':
+        mergeOutput = optarg;
+        break;
+      case 'C':
+        coordinatorAddress = optarg;
+        break;
+      case 'W':
+        workerAddress = optarg;
+        break;
+      case 's':
+        tileSize = std::max(1, atoi(optarg));
+        break;
+      case 'H':
+        if (!Arena::enableHugePages())
+          std::cerr << "Transparent huge pages aren't supported on this system, ignoring --huge-pages." << std::endl;
+        break;
       default:
-        std::cerr << "usage: " << argv[0] << " [-t numThreads] filepath" << std::endl;
+        printUsage(argv[0]);
         return -1;
     }
   }
+  if (!mergeOutput.empty()) {
+    if (optind == argc) {
+      printUsage(argv[0]);
+      return 1;
+    }
+    return mergeAccumulationFiles(mergeOutput, argv + optind, argc - optind);
+  }
+  if (!workerAddress.empty()) {
+    return runWorker(workerAddress, numThreads);
+  }
+  if (optind != argc - 1) {
+    printUsage(argv[0]);
+    return 1;
+  }
+  if (!coordinatorAddress.empty()) {
+    return runCoordinator(coordinatorAddress, argv[optind], tileSize, seed, sampleOffset);
+  }
 
-  std::unique_ptr<Scene> scene = readFromFile(argv[argc - 1]);
+  std::unique_ptr<Scene> scene = readFromFile(argv[optind]);
   if (!scene) {
     return 1;
   }
+  // Command line settings take precedence over the scene file
+  if (timeBudget > 0)
+    scene->options.timeBudget = timeBudget;
+  if (writeInterval > 0)
+    scene->options.writeInterval = writeInterval;
+  scene->options.checkpointFile = checkpointFile;
+  scene->options.resume = resume;
+  scene->options.sampleOffset = sampleOffset;
 
-  PNG *renderedScene = scene->render(numThreads);
+  PNG *renderedScene = scene->render(numThreads, seed);
+  if (!renderedScene) {
+    return 1;
+  }
   renderedScene->saveToFile(scene->filename());
   printStats();
   delete renderedScene;
@@ -0,0 +1,29 @@
+#include "AssetCache.h"
+#include "parser.h"
+
+#include "../macros.h"
+
+#include <climits>
+#include <sys/stat.h>
+
+static AssetCache<Texture> textures;
+static AssetCache<WavefrontOBJ> wavefronts;
+
+std::string assetKey(const std::string &filename) {
+  char canonicalPath[PATH_MAX];
+  if (realpath(filename.c_str(), canonicalPath) == nullptr)
+    return filename;
+
+  struct stat info;
+  if (stat(canonicalPath, &info) != 0)
+    return canonicalPath;
+  return std::string(canonicalPath) + '@' + std::to_string(info.st_mtime);
+}
+
+Asset<Texture> loadTexture(const std::string &filename) {
+  return textures.load(filename);
+}
+
+Asset<WavefrontOBJ> loadWavefront(const std::string &filename) {
+  return wavefronts.load(filename);
+}
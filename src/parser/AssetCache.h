@@ -0,0 +1,68 @@
+#pragma once
+
+#include "../macros.h"
+#include "../image/Texture.h"
+
+struct WavefrontOBJ;
+
+/**
+ * assetKey
+ *
+ * Identifies a file on disk by its canonical path and modification time, so that every
+ * reference to the same file shares one copy while edits made between loads are picked up.
+ *
+ * filename - path to the asset as written in the scene file
+*/
+std::string assetKey(const std::string &filename);
+
+/**
+ * Asset struct
+ *
+ * data  - the asset, which is filled in on a background thread.
+ * ready - becomes ready once data has been read from disk.
+*/
+template <typename T>
+struct Asset {
+  std::shared_ptr<T> data;
+  std::shared_future<void> ready;
+};
+
+/**
+ * class AssetCache
+ *
+ * Thread-safe cache that reads each asset from disk exactly once per process.
+ * T must be default constructible and provide readFromFile(const std::string &).
+*/
+template <typename T>
+class AssetCache {
+public:
+  Asset<T> load(const std::string &filename) {
+    std::string key = assetKey(filename);
+    std::lock_guard<std::mutex> lock(m);
+    auto it = assets.find(key);
+    if (it != assets.end())
+      return it->second;
+
+    std::shared_ptr<T> data = std::make_shared<T>();
+    std::shared_future<void> ready = std::async(std::launch::async, [data, filename]() {
+      data->readFromFile(filename);
+    }).share();
+    Asset<T> asset{ data, ready };
+    assets.insert({ key, asset });
+    return asset;
+  }
+
+private:
+  mutable std::mutex m;
+  std::unordered_map<std::string, Asset<T>> assets;
+};
+
+/**
+ * loadTexture - returns the process wide copy of the texture decoded from the PNG image at filename.
+*/
+Asset<Texture> loadTexture(const std::string &filename);
+
+/**
+ * loadWavefront - returns the process wide copy of the parsed .obj file at filename.
+*/
+Asset<WavefrontOBJ> loadWavefront(const std::string &filename);
@@ -120,7 +120,7 @@ PointLight *parsePointLightOptions(const std::unordered_map<std::string, std::st
   return new PointLight(center, color);
 }
 
-EnvironmentLight *parseEnvironmentLightOptions(const std::unordered_map<std::string, std::string> &options, const std::string &path, const Vector3D &center) {
+EnvironmentLight *parseEnvironmentLightOptions(const std::unordered_map<std::string, std::string> &options, const std::string &path, Scene *scene) {
   auto stof = [](const std::string &str) {
     return std::stof(str);
   };
@@ -129,19 +129,20 @@ EnvironmentLight *parseEnvironmentLightOptions(const std::unordered_map<std::str
   if (path.empty()) {
     Vector3D temp = getDefaultOptionOrApply<Vector3D>(options, "color", &stringTupleToVector3D, Vector3D(1, 1, 1));
     RGBAColor color(temp.x, temp.y, temp.z, 1);
-    return new EnvironmentLight(center, radius, color);
+    return new EnvironmentLight(Vector3D(), radius, color);
   }
 
   float scale = getDefaultOptionOrApply<float>(options, "scale", stof, 1.0f);
-  return new EnvironmentLight(center, radius, scale, std::make_shared<PNG>(path));
+  return new EnvironmentLight(Vector3D(), radius, scale, loadTextureAsync(path, scene));
 }
 
 Sphere *parseSphereOptions(
+  Arena &arena,
   const std::unordered_map<std::string, std::string> &options,
   RGBAColor color,
   ObjectType objectType,
   std::shared_ptr<Material> material,
-  std::shared_ptr<PNG> texture
+  std::shared_ptr<Texture> texture
 )
 {
   auto stof = [](const std::string &str) {
@@ -159,15 +160,16 @@ Sphere *parseSphereOptions(
   }
 
   // @TODO make sure center, color, and radius are set, otherwise return false
-  return new Sphere(center, radius, color, material, texture);
+  return arena.create<Sphere>(center, radius, color, material, texture);
 }
 
 Triangle *parseTriangleOptions(
+  Arena &arena,
   const std::unordered_map<std::string, std::string> &options,
   RGBAColor color,
   ObjectType objectType,
   std::shared_ptr<Material> material,
-  std::shared_ptr<PNG> texture
+  std::shared_ptr<Texture> texture
 )
 {
 
@@ -188,7 +190,7 @@ Triangle *parseTriangleOptions(
   }
 
   // @TODO make sure p1, p2, and p3 are set, otherwise return false
-  return new Triangle(p1, p2, p3, color, material, t1, t2, t3, texture);
+  return arena.create<Triangle>(p1, p2, p3, color, material, t1, t2, t3, texture);
 }
 
 Plane *parsePlaneOptions(
@@ -196,7 +198,7 @@ Plane *parsePlaneOptions(
   RGBAColor color,
   ObjectType objectType,
   std::shared_ptr<Material> material,
-  std::shared_ptr<PNG> texture
+  std::shared_ptr<Texture> texture
 )
 {
   auto stof = [](const std::string &str) {
@@ -274,6 +276,64 @@ void ParserTree::parseSceneNode(Node *node, Scene *scene) {
   sceneOptions.fisheye    = getDefaultOptionOrApply<int>(options, "fisheye", stoi, 0);
   sceneOptions.focus      = getDefaultOptionOrApply<float>(options, "focus", stof, -1.0f);
   sceneOptions.lens       = getDefaultOptionOrApply<float>(options, "lens", stoi, 0.0f);
+  sceneOptions.lightSamples = getDefaultOptionOrApply<int>(options, "lightSamples", stoi, 4);
+  sceneOptions.adaptiveThreshold = getDefaultOptionOrApply<float>(options, "adaptiveThreshold", stof, -1.0f);
+  sceneOptions.maxRays    = getDefaultOptionOrApply<int>(options, "maxRays", stoi, 1024);
+  sceneOptions.timeBudget = getDefaultOptionOrApply<float>(options, "timeBudget", stof, -1.0f);
+  sceneOptions.writeInterval = getDefaultOptionOrApply<float>(options, "writeInterval", stof, -1.0f);
+  sceneOptions.rouletteDepth = getDefaultOptionOrApply<int>(options, "rouletteDepth", stoi, sceneOptions.maxBounces);
+  sceneOptions.splitting  = getDefaultOptionOrApply<int>(options, "splitting", stoi, 1);
+  sceneOptions.sortRays   = getDefaultOptionOrApply<int>(options, "sortRays", stoi, 1);
+  sceneOptions.sortHits   = getDefaultOptionOrApply<int>(options, "sortHits", stoi, 1);
+  sceneOptions.packetSize = getDefaultOptionOrApply<int>(options, "packetSize", stoi, 1);
+  if (sceneOptions.packetSize != 1 && sceneOptions.packetSize != 4 && sceneOptions.packetSize != MAX_PACKET_SIZE) {
+    std::cerr << "packetSize must be 1, 4 or " << MAX_PACKET_SIZE << ", using 1." << std::endl;
+    sceneOptions.packetSize = 1;
+  }
+  sceneOptions.quantizeBVH = getDefaultOptionOrApply<int>(options, "quantizeBVH", stoi, 0);
+
+  auto integratorIt = options.find("integrator");
+  if (integratorIt != options.end()) {
+    if (integratorIt->second == "wavefront") {
+      sceneOptions.integrator = IntegratorType::Wavefront;
+    } else if (integratorIt->second == "path") {
+      sceneOptions.integrator = IntegratorType::Path;
+    } else {
+      std::cerr << "Unknown integrator " << integratorIt->second << ", using path." << std::endl;
+    }
+  }
+
+  auto layoutIt = options.find("bvhLayout");
+  if (layoutIt != options.end()) {
+    if (layoutIt->second == "depthFirst") {
+      sceneOptions.bvhLayout = BVHLayout::DepthFirst;
+    } else if (layoutIt->second == "subtreeSize") {
+      sceneOptions.bvhLayout = BVHLayout::SubtreeSize;
+    } else if (layoutIt->second == "vanEmdeBoas") {
+      sceneOptions.bvhLayout = BVHLayout::VanEmdeBoas;
+    } else if (layoutIt->second == "lineTreelets") {
+      sceneOptions.bvhLayout = BVHLayout::LineTreelets;
+    } else if (layoutIt->second == "pageTreelets") {
+      sceneOptions.bvhLayout = BVHLayout::PageTreelets;
+    } else {
+      std::cerr << "Unknown BVH layout " << layoutIt->second << ", using depthFirst." << std::endl;
+    }
+  }
+
+  auto samplerIt = options.find("sampler");
+  if (samplerIt != options.end()) {
+    if (samplerIt->second == "random") {
+      sceneOptions.sampler = SamplerType::Random;
+    } else if (samplerIt->second == "sobol") {
+      sceneOptions.sampler = SamplerType::Sobol;
+    } else {
+      std::cerr << "Unknown sampler " << samplerIt->second << ", using sobol." << std::endl;
+    }
+  }
+
+  auto sampleMapIt = options.find("sampleMap");
+  if (sampleMapIt != options.end())
+    sceneOptions.sampleMap = sampleMapIt->second;
 
   int width;
   int height;
@@ -347,7 +407,10 @@ void ParserTree::parseLightNode(Node *node, Scene *scene) {
     std::string path = "";
     if (node->content.find("path") != std::string::npos)
       path = parseKeyword(node->content, "path");
-    light = parseEnvironmentLightOptions(options, path, scene->worldCenter());
+    EnvironmentLight *environmentLight = parseEnvironmentLightOptions(options, path, scene);
+    // meshes may still be loading, so the world center is only known once loading finishes
+    scene->centerOnWorld(environmentLight);
+    light = environmentLight;
   } else {
     // unknown light type
     return;
@@ -408,9 +471,9 @@ std::shared_ptr<Material> ParserTree::parseMaterialNode(Node *node, RGBAColor *c
   }
 }
 
-std::shared_ptr<PNG> ParserTree::parseTextureNode(Node *node) {
+std::shared_ptr<Texture> ParserTree::parseTextureNode(Node *node, Scene *scene) {
   std::string path = parseKeyword(node->content, "path");
-  return std::make_shared<PNG>(path);
+  return loadTextureAsync(path, scene);
 }
 
 void ParserTree::parseShapeNode(Node *node, Scene *scene) {
@@ -420,21 +483,21 @@ void ParserTree::parseShapeNode(Node *node, Scene *scene) {
   RGBAColor color(1,1,1,1);
   ObjectType objectType = ObjectType::Diffuse;
   std::shared_ptr<Material> material = NamedMaterials.at("default");
-  std::shared_ptr<PNG> texture = nullptr;
+  std::shared_ptr<Texture> texture = nullptr;
 
   for (Node *child : node->children) {
     if (child->type == Tag::Material) {
       material = parseMaterialNode(child, &color, &objectType);
     } else if (child->type == Tag::Texture) {
-      texture = parseTextureNode(child);
+      texture = parseTextureNode(child, scene);
     }
   }
 
   if (type == "sphere") {
-    Sphere *sphere = parseSphereOptions(options, color, objectType, material, texture);
-    scene->addObject(std::unique_ptr<Object>(sphere));
+    Sphere *sphere = parseSphereOptions(scene->objectArena(), options, color, objectType, material, texture);
+    scene->addObject(ArenaPtr<Object>(sphere));
   } else if (type == "triangle") {
-    Triangle *triangle = parseTriangleOptions(options, color, objectType, material, texture);
+    Triangle *triangle = parseTriangleOptions(scene->objectArena(), options, color, objectType, material, texture);
     bool isInFront = dot(scene->camera.forward, triangle->centroid - scene->camera.eye) > 0;
     bool isWithForward = dot(scene->camera.forward, triangle->normal) > 0;
     if (isInFront && isWithForward) {
@@ -443,7 +506,7 @@ void ParserTree::parseShapeNode(Node *node, Scene *scene) {
     triangle->n1 = triangle->normal;
     triangle->n2 = triangle->normal;
     triangle->n3 = triangle->normal;
-    scene->addObject(std::unique_ptr<Triangle>(triangle));
+    scene->addObject(ArenaPtr<Triangle>(triangle));
   } else if (type == "plane") {
     Plane *plane = parsePlaneOptions(options, color, objectType, material, texture);
     bool isWithForward = dot(scene->camera.forward, plane->normal) > 0;
@@ -484,7 +547,7 @@ void ParserTree::parseWavefrontNode(Node *node, Scene *scene) {
     color.b = temp.z;
   }
 
-  loadOBJ(center, scale, path, scene, color, material);
+  loadOBJAsync(center, scale, path, scene, color, material);
 }
 
 void ParserTree::parseNode(Node *node, Scene *scene) {
@@ -50,29 +50,31 @@ PointLight *parsePointLightOptions(const std::unordered_map<std::string, std::st
 EnvironmentLight *parseEnvironmentLightOptions(
   const std::unordered_map<std::string, std::string> &options,
   const std::string &path,
-  const Vector3D &center
+  Scene *scene
 );
 
 Sphere *parseSphereOptions(
+  Arena &arena,
   const std::unordered_map<std::string, std::string> &options,
   RGBAColor color,
   ObjectType objectType,
   std::shared_ptr<Material> material,
-  std::shared_ptr<PNG> texture
+  std::shared_ptr<Texture> texture
 );
 Triangle *parseTriangleOptions(
+  Arena &arena,
   const std::unordered_map<std::string, std::string> &options,
   RGBAColor color,
   ObjectType objectType,
   std::shared_ptr<Material> material,
-  std::shared_ptr<PNG> texture
+  std::shared_ptr<Texture> texture
 );
 Plane *parsePlaneOptions(
   const std::unordered_map<std::string, std::string> &options,
   RGBAColor color,
   ObjectType objectType,
   std::shared_ptr<Material> material,
-  std::shared_ptr<PNG> texture
+  std::shared_ptr<Texture> texture
 );
 
 class ParserTree {
@@ -99,7 +101,7 @@ private:
   void parseShapeNode(Node *node, Scene *scene);
   void parseWavefrontNode(Node *node, Scene *scene);
   std::shared_ptr<Material> parseMaterialNode(Node *node, RGBAColor *color, ObjectType *type);
-  std::shared_ptr<PNG> parseTextureNode(Node *node);
+  std::shared_ptr<Texture> parseTextureNode(Node *node, Scene *scene);
   void print(Node *node);
   void build(std::ifstream &filestream, Node *node);
   void clear(Node *node);
@@ -1,5 +1,6 @@
 #include "parser.h"
 #include "ParserTree.h"
+#include "AssetCache.h"
 
 #include "../macros.h"
 #include "../scene/raytracer.h"
@@ -44,24 +45,14 @@ std::vector<int> parseOBJPoint(const std::string &s) {
   return indices;
 }
 
-bool loadOBJ(
-  const Vector3D &center,
-  float scale,
-  const std::string &filename,
-  Scene *scene,
-  const RGBAColor &color,
-  const std::shared_ptr<Material> material)
-{
+bool WavefrontOBJ::readFromFile(const std::string &filename) {
   std::ifstream infile(filename);
   if (!infile) {
     std::cerr << "Couldn't open file " << filename << std::endl;
     return false;
   }
 
-  std::vector<Vector3D> points;
-  std::vector<Vector3D> normals;
   std::vector<std::string> lineInfo;
-  Box extent;
 
   for (std::string line; std::getline(infile, line);) {
     lineInfo = split(line, ' ');
@@ -83,9 +74,48 @@ bool loadOBJ(
       float y = std::stof(lineInfo.at(2));
       float z = std::stof(lineInfo.at(3));
       normals.emplace_back(x, y, z);
+    } else if (keyword == "f") {
+      // didn't deal with negative indices yet
+      std::vector<int> vertex1 = parseOBJPoint(lineInfo.at(1));
+      bool hasNormals = vertex1.size() == 3;
+      for (size_t idx = 2; idx < lineInfo.size() - 1; ++idx) {
+        std::vector<int> vertex2 = parseOBJPoint(lineInfo.at(idx));
+        std::vector<int> vertex3 = parseOBJPoint(lineInfo.at(idx + 1));
+        faces.push_back({ vertex1.at(0) - 1, vertex2.at(0) - 1, vertex3.at(0) - 1 });
+        if (hasNormals) {
+          faceNormals.push_back({ vertex1.at(2) - 1, vertex2.at(2) - 1, vertex3.at(2) - 1 });
+        } else {
+          faceNormals.push_back({ -1, -1, -1 });
+        }
+      }
     }
   }
 
+  loaded = true;
+  return true;
+}
+
+bool loadOBJ(
+  const Vector3D &center,
+  float scale,
+  const std::string &filename,
+  Mesh *mesh,
+  const RGBAColor &color,
+  const std::shared_ptr<Material> material)
+{
+  // Every instance of the same file shares one parsed copy
+  Asset<WavefrontOBJ> asset = loadWavefront(filename);
+  // get rethrows a failed read into the mesh's future, which finishLoading reports
+  asset.ready.get();
+  const WavefrontOBJ &obj = *asset.data;
+  if (obj.loaded == false) {
+    return false;
+  }
+
+  const std::vector<Vector3D> &points = obj.points;
+  const std::vector<Vector3D> &normals = obj.normals;
+  const Box &extent = obj.extent;
+
   // We want to center the object at 'center', so shift each point by 'center - (extent.maxPoint + extent.minPoint / 2)'
   // Also want to scale the obj down to a max of 1 along the biggest dimension to normalize,
   // so divide each point by 'max(extent.maxPoint - extent.minPoint)'
@@ -93,54 +123,62 @@ bool loadOBJ(
   Vector3D shift = center - (extent.maxPoint + extent.minPoint) / 2;
   float scaleFactor = scale / maxDimension(extent.maxPoint - extent.minPoint);
   int numObjects = 0;
-  infile = std::ifstream(filename);
+  int numPoints = points.size();
+  mesh->objects.reserve(obj.faces.size());
 
-  for (std::string line; std::getline(infile, line);) {
-    lineInfo = split(line, ' ');
-    if (lineInfo.size() == 0) {
+  for (size_t f = 0; f < obj.faces.size(); ++f) {
+    int i = obj.faces[f][0];
+    int j = obj.faces[f][1];
+    int k = obj.faces[f][2];
+    // Try skipping invalid indices?
+    if (i >= numPoints || j >= numPoints || k >= numPoints) {
+      std::cout << "Indices out of range: " << i << ' ' << j << ' ' << k << std::endl;
       continue;
     }
 
-    std::string keyword = lineInfo.at(0);
+    Vector3D v1 = scaleFactor * points.at(i) + shift;
+    Vector3D v2 = scaleFactor * points.at(j) + shift;
+    Vector3D v3 = scaleFactor * points.at(k) + shift;
 
-    if (keyword == "f") {
-      // didn't deal with negative indices yet
-      int numPoints = points.size();
-      std::vector<int> vertex1 = parseOBJPoint(lineInfo.at(1));
-      int i = vertex1.at(0) - 1;
-      int j;
-      int k;
-      for (size_t idx = 2; idx < lineInfo.size() - 1; ++idx) {
-        std::vector<int> vertex2 = parseOBJPoint(lineInfo.at(idx));
-        std::vector<int> vertex3 = parseOBJPoint(lineInfo.at(idx + 1));
-        j = vertex2.at(0) - 1;
-        k = vertex3.at(0) - 1;
-        // Try skipping invalid indices?
-        if (i >= numPoints || j >= numPoints || k >= numPoints) {
-          std::cout << "Indices out of range: " << i << ' ' << j << ' ' << k << std::endl;
-          continue;
-        }
-
-        Vector3D v1 = scaleFactor * points.at(i) + shift;
-        Vector3D v2 = scaleFactor * points.at(j) + shift;
-        Vector3D v3 = scaleFactor * points.at(k) + shift;
-
-        std::unique_ptr<Triangle> newObject = std::make_unique<Triangle>(v1, v2, v3, color, material);
-        if (vertex1.size() == 3) {
-          newObject->n1 = normals.at(vertex1.at(2) - 1);
-          newObject->n2 = normals.at(vertex2.at(2) - 1);
-          newObject->n3 = normals.at(vertex3.at(2) - 1);
-        }
-        scene->addObject(std::move(newObject));
-        ++numObjects;
-      }
+    ArenaPtr<Triangle> newObject = mesh->arena.make<Triangle>(v1, v2, v3, color, material);
+    const std::array<int, 3> &n = obj.faceNormals[f];
+    if (n[0] != -1) {
+      newObject->n1 = normals.at(n[0]);
+      newObject->n2 = normals.at(n[1]);
+      newObject->n3 = normals.at(n[2]);
     }
+    mesh->objects.push_back(std::move(newObject));
+    ++numObjects;
   }
   
   std::cout << "Scanned " << points.size() << " points and " << numObjects << " objects" << std::endl;
   return true;
 }
 
+void loadOBJAsync(
+  const Vector3D &center,
+  float scale,
+  const std::string &filename,
+  Scene *scene,
+  const RGBAColor &color,
+  const std::shared_ptr<Material> material)
+{
+  scene->addMesh(std::async(std::launch::async, [=]() {
+    std::unique_ptr<Mesh> mesh = std::make_unique<Mesh>();
+    if (loadOBJ(center, scale, filename, mesh.get(), color, material) == false)
+      return std::unique_ptr<Mesh>(nullptr);
+    // Start building this mesh's BVH right away instead of waiting on the other assets
+    mesh->bvh = std::make_unique<BVH>(mesh->objects);
+    return mesh;
+  }));
+}
+
+std::shared_ptr<Texture> loadTextureAsync(const std::string &filename, Scene *scene) {
+  Asset<Texture> texture = loadTexture(filename);
+  scene->addLoadTask(texture.ready);
+  return texture.data;
+}
+
 std::unique_ptr<Scene> readDataFromStream(std::istream& in) {
   std::string line;
   std::getline(in, line);
@@ -165,8 +203,7 @@ std::unique_ptr<Scene> readDataFromStream(std::istream& in) {
   std::shared_ptr<Material> currentMaterial = std::make_shared<Material>();
   RGBAColor currentColor(1, 1, 1, 1);
   ObjectType currentObjectType = ObjectType::Diffuse;
-  std::unordered_map<std::string, std::shared_ptr<PNG>> textures;
-  std::shared_ptr<PNG> currentTexture = nullptr;
+  std::shared_ptr<Texture> currentTexture = nullptr;
   Camera camera;
   SceneOptions options;
 
@@ -183,7 +220,7 @@ std::unique_ptr<Scene> readDataFromStream(std::istream& in) {
       float y = std::stof(lineInfo.at(2));
       float z = std::stof(lineInfo.at(3));
       float r = std::stof(lineInfo.at(4));
-      std::unique_ptr<Sphere> newObject = std::make_unique<Sphere>(Vector3D(x, y, z), r, currentColor, currentMaterial, currentTexture);
+      ArenaPtr<Sphere> newObject = scene->objectArena().make<Sphere>(Vector3D(x, y, z), r, currentColor, currentMaterial, currentTexture);
       newObject->type = currentObjectType;
       scene->addObject(std::move(newObject));
     } else if (keyword == "sun") {
@@ -213,20 +250,14 @@ std::unique_ptr<Scene> readDataFromStream(std::istream& in) {
       EnvironmentLight *light;
       float radius = std::stof(lineInfo.at(1));
       if (lineInfo.size() < 3) {
-        light = new EnvironmentLight(scene->worldCenter(), radius, currentColor);
+        light = new EnvironmentLight(Vector3D(), radius, currentColor);
       } else {
         float scale = std::stof(lineInfo.at(2));
-        const std::string &textureName = lineInfo.at(3);
-        std::shared_ptr<PNG> luminanceMap = nullptr;
-        if (textures.find(textureName) != textures.end()) {
-          luminanceMap = textures[textureName];
-        } else {
-          luminanceMap = std::make_shared<PNG>(textureName);
-          textures[textureName] = luminanceMap;
-        }
-        light = new EnvironmentLight(scene->worldCenter(), radius, scale, luminanceMap);
+        std::shared_ptr<Texture> luminanceMap = loadTextureAsync(lineInfo.at(3), scene);
+        light = new EnvironmentLight(Vector3D(), radius, scale, luminanceMap);
       }
       scene->addLight(light);
+      scene->centerOnWorld(light);
     } else if (keyword == "xyz") {
       float x = std::stof(lineInfo.at(1));
       float y = std::stof(lineInfo.at(2));
@@ -245,7 +276,7 @@ std::unique_ptr<Scene> readDataFromStream(std::istream& in) {
       if (k < 0) {
         k += points.size() + 1;
       }
-      std::unique_ptr<Triangle> newObject = std::make_unique<Triangle>(points.at(i), points.at(j), points.at(k), currentColor, currentMaterial);
+      ArenaPtr<Triangle> newObject = scene->objectArena().make<Triangle>(points.at(i), points.at(j), points.at(k), currentColor, currentMaterial);
       newObject->type = currentObjectType;
       // Orient the normal if the normal faces with the forward vector and the object is in front of the camera
       // I think this works??
@@ -338,19 +369,13 @@ std::unique_ptr<Scene> readDataFromStream(std::istream& in) {
       currentObjectType = ObjectType::Reflective;
       currentMaterial = std::make_shared<Material>(0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, MaterialType::Dialectric);
     } else if (keyword == "texture") {
-      const std::string &textureName = lineInfo.at(1);
-      if (textures.find(textureName) != textures.end()) {
-        currentTexture = textures[textureName];
-      } else {
-        currentTexture = std::make_shared<PNG>(textureName);
-        textures[textureName] = currentTexture;
-      }
+      currentTexture = loadTextureAsync(lineInfo.at(1), scene);
     } else if (keyword == "obj") {
       float x = std::stof(lineInfo.at(1));
       float y = std::stof(lineInfo.at(2));
       float z = std::stof(lineInfo.at(3));
       float s = std::stof(lineInfo.at(4));
-      bool error = loadOBJ(Vector3D(x, y, z), s, lineInfo.at(5), scene, currentColor, currentMaterial);
+      loadOBJAsync(Vector3D(x, y, z), s, lineInfo.at(5), scene, currentColor, currentMaterial);
     }
   }
 
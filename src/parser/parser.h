@@ -14,7 +14,45 @@ std::vector<int> parseOBJPoint(const std::string &s);
 
 std::unique_ptr<Scene> readDataFromStream(std::istream& in);
 
+/**
+ * WavefrontOBJ struct
+ * 
+ * Geometry parsed from a Wavefront .obj file before it is placed in a scene.
+ * 
+ * points      - vertex positions
+ * normals     - vertex normals
+ * faces       - triangulated faces as indices into points
+ * faceNormals - indices into normals for each corner of a face, or -1 if the face has no normals
+ * extent      - bounding box of points
+ * loaded      - whether the file was read successfully
+*/
+struct WavefrontOBJ {
+  bool readFromFile(const std::string &filename);
+
+  std::vector<Vector3D> points;
+  std::vector<Vector3D> normals;
+  std::vector<std::array<int, 3>> faces;
+  std::vector<std::array<int, 3>> faceNormals;
+  Box extent;
+  bool loaded = false;
+};
+
 bool loadOBJ(
+  const Vector3D &center,
+  float scale,
+  const std::string &filename,
+  Mesh *mesh,
+  const RGBAColor &color,
+  const std::shared_ptr<Material> material
+);
+
+/**
+ * loadOBJAsync
+ * 
+ * Loads a Wavefront .obj file and builds its BVH on a background thread.
+ * The resulting mesh is handed to the scene, which splices it in before rendering.
+*/
+void loadOBJAsync(
   const Vector3D &center,
   float scale,
   const std::string &filename,
@@ -23,4 +61,12 @@ bool loadOBJ(
   const std::shared_ptr<Material> material
 );
 
+/**
+ * loadTextureAsync
+ * 
+ * Returns a texture that is decoded from the PNG at filename on a background thread.
+ * The scene waits on the decode before rendering.
+*/
+std::shared_ptr<Texture> loadTextureAsync(const std::string &filename, Scene *scene);
+
 std::unique_ptr<Scene> readFromFile(const std::string& filename);
\ No newline at end of file
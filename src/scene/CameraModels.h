@@ -0,0 +1,165 @@
+#pragma once
+
+#include "Camera.h"
+#include "raytracer.h"
+
+#include "../macros.h"
+#include "../vector/vector3d.h"
+#include "../bsdf/Sampler.h"
+
+/**
+ * Camera models are the template parameter of Scene::threadTask. A model is built once per worker from the
+ * scene camera and image size, so the constants of its projection are computed up front and generateRay
+ * only does the work that changes per sample. A model provides:
+ *
+ *  CameraModel(const Camera &camera, const SceneOptions &options, int width, int height)
+ *  bool generateRay(float px, float py, Sampler &sampler, Vector3D &origin, Vector3D &direction) const
+ *    - ray through the film position (px, py) in pixels, or false if the camera doesn't see that position.
+ *      Lens samples come from the sampler's current dimensions.
+*/
+
+/**
+ * class FilmPlane
+ *
+ * Maps film positions in pixels to (Sx, Sy), where camera rays pass through 'forward' + Sx * 'right' + Sy * 'up'
+ * and the longer side of the image spans [-1, 1] (see getRayScaleX and getRayScaleY).
+ *
+ * private members:
+ *  scale   - change in Sx and Sy per pixel
+ *  offsetX - Sx at px = 0
+ *  offsetY - Sy at py = 0
+*/
+class FilmPlane {
+public:
+  /**
+   * FilmPlane - mapping for a width x height image with Sx and Sy divided by extent.
+  */
+  FilmPlane(int width, int height, float extent=1.0f)
+    : scale(2.0f / (std::max(width, height) * extent)),
+      offsetX(-0.5f * width * scale),
+      offsetY(0.5f * height * scale) {};
+
+  float scaleX(float px) const {
+    return px * scale + offsetX;
+  }
+
+  float scaleY(float py) const {
+    return offsetY - py * scale;
+  }
+
+private:
+  float scale;
+  float offsetX;
+  float offsetY;
+};
+
+/**
+ * class PinholeCamera
+ *
+ * Every ray starts at the eye. The film plane mapping is folded into the camera vectors, so a direction
+ * is a corner plus two steps.
+ *
+ * private members:
+ *  eye     - origin of every ray
+ *  topLeft - direction through film position (0, 0)
+ *  stepX   - change in direction per pixel to the right
+ *  stepY   - change in direction per pixel down
+*/
+class PinholeCamera {
+public:
+  PinholeCamera(const Camera &camera, const SceneOptions &, int width, int height) : eye(camera.eye) {
+    FilmPlane film(width, height);
+    topLeft = camera.forward + film.scaleX(0) * camera.right + film.scaleY(0) * camera.up;
+    stepX = (film.scaleX(1) - film.scaleX(0)) * camera.right;
+    stepY = (film.scaleY(1) - film.scaleY(0)) * camera.up;
+  }
+
+  bool generateRay(float px, float py, Sampler &, Vector3D &origin, Vector3D &direction) const {
+    origin = eye;
+    direction = topLeft + px * stepX + py * stepY;
+    return true;
+  }
+
+private:
+  Vector3D eye;
+  Vector3D topLeft;
+  Vector3D stepX;
+  Vector3D stepY;
+};
+
+/**
+ * class FisheyeCamera
+ *
+ * The film plane, divided by |forward|, is lifted onto the hemisphere around forward. Film positions
+ * outside the unit disk aren't seen.
+ *
+ * private members:
+ *  film    - film plane divided by |forward|
+ *  eye     - origin of every ray
+ *  forward - normalized camera forward
+ *  right   - camera right
+ *  up      - camera up
+*/
+class FisheyeCamera {
+public:
+  FisheyeCamera(const Camera &camera, const SceneOptions &, int width, int height)
+    : film(width, height, magnitude(camera.forward)),
+      eye(camera.eye), forward(normalized(camera.forward)), right(camera.right), up(camera.up) {};
+
+  bool generateRay(float px, float py, Sampler &, Vector3D &origin, Vector3D &direction) const {
+    float Sx = film.scaleX(px);
+    float Sy = film.scaleY(py);
+    float r_2 = Sx * Sx + Sy * Sy;
+    if (r_2 > 1)
+      return false;
+
+    origin = eye;
+    direction = sqrtf(1 - r_2) * forward + Sx * right + Sy * up;
+    return true;
+  }
+
+private:
+  FilmPlane film;
+  Vector3D eye;
+  Vector3D forward;
+  Vector3D right;
+  Vector3D up;
+};
+
+/**
+ * class ThinLensCamera
+ *
+ * Rays start on a lens around the eye and pass through the point the pinhole ray hits on the plane of
+ * focus, so only that plane is sharp. Takes two sampler dimensions for the position on the lens.
+ *
+ * private members:
+ *  pinhole - camera whose rays are focused
+ *  focus   - distance from the eye to the plane of focus along each pinhole ray
+ *  lensX   - lens offset along right per unit of lens radius
+ *  lensY   - lens offset along up per unit of lens radius
+*/
+class ThinLensCamera {
+public:
+  ThinLensCamera(const Camera &camera, const SceneOptions &options, int width, int height)
+    : pinhole(camera, options, width, height), focus(options.focus),
+      lensX(options.lens / magnitude(camera.right) * camera.right),
+      lensY(options.lens / magnitude(camera.up) * camera.up) {};
+
+  bool generateRay(float px, float py, Sampler &sampler, Vector3D &origin, Vector3D &direction) const {
+    Vector3D eye;
+    pinhole.generateRay(px, py, sampler, eye, direction);
+    Vector3D focusPoint = focus / magnitude(direction) * direction + eye;
+
+    float angle = sampler() * 2 * M_PI;
+    float r = sampler() - 0.5f;
+    origin = r * cosf(angle) * lensX + r * sinf(angle) * lensY + eye;
+    direction = focusPoint - origin;
+    return true;
+  }
+
+private:
+  PinholeCamera pinhole;
+  float focus;
+  Vector3D lensX;
+  Vector3D lensY;
+};
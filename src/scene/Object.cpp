@@ -9,12 +9,22 @@ bool DistantLight::pointInShadow(const Vector3D &point, const Vector3D &directio
   return info.obj != nullptr;
 }
 
-RGBAColor DistantLight::intensity(const Vector3D &point, const Vector3D &n, const Scene *scene, UniformDistribution &sampler) const {
+RGBAColor DistantLight::intensity(const Vector3D &point, const Vector3D &n, const Scene *scene, Sampler &sampler) const {
   if (pointInShadow(point, direction, scene))
     return RGBAColor(0, 0, 0, 1);
   return color * clipDot(n, direction);
 }
 
+RGBAColor DistantLight::sampleDelta(const Vector3D &point, const Vector3D &n, Vector3D *wi) const {
+  *wi = direction;
+  return color * clipDot(n, direction);
+}
+
+float DistantLight::power(float sceneRadius) const {
+  // Light crossing the disk the scene covers
+  return M_PI * sceneRadius * sceneRadius * luminance(color);
+}
+
 bool PointLight::pointInShadow(const Vector3D &point, const Vector3D &direction, const Scene *scene) const {
   const Vector3D lightDirection = center - point;
   float intersectToBulbDist = magnitude(lightDirection);
@@ -24,7 +34,7 @@ bool PointLight::pointInShadow(const Vector3D &point, const Vector3D &direction,
   return info.obj != nullptr && objectToIntersect < intersectToBulbDist;
 }
 
-RGBAColor PointLight::intensity(const Vector3D &point, const Vector3D &n, const Scene *scene, UniformDistribution &sampler) const {
+RGBAColor PointLight::intensity(const Vector3D &point, const Vector3D &n, const Scene *scene, Sampler &sampler) const {
   const Vector3D lightDirection = center - point;
   if (pointInShadow(point, lightDirection, scene))
     return RGBAColor(0, 0, 0, 1);
@@ -33,25 +43,139 @@ RGBAColor PointLight::intensity(const Vector3D &point, const Vector3D &n, const
   return color * clipDot(n, lightDirection) * invDistance;
 }
 
+RGBAColor PointLight::sampleDelta(const Vector3D &point, const Vector3D &n, Vector3D *wi) const {
+  *wi = center - point;
+  float distance = magnitude(*wi);
+  float invDistance =  1.0f / (distance * distance);
+  return color * clipDot(n, *wi) * invDistance;
+}
+
+float PointLight::power(float sceneRadius) const {
+  return 4.0f * M_PI * luminance(color);
+}
+
 bool EnvironmentLight::pointInShadow(const Vector3D &point, const Vector3D &direction, const Scene *scene) const {
   IntersectionInfo info = scene->findAnyObject(point, direction);
   return info.obj != nullptr;
 }
 
-RGBAColor EnvironmentLight::intensity(const Vector3D &point, const Vector3D &n, const Scene *scene, UniformDistribution &sampler) const {
-  Vector3D wi = sampleHemisphere(n, sampler);
-  if (pointInShadow(point, wi, scene))
+RGBAColor EnvironmentLight::intensity(const Vector3D &point, const Vector3D &n, const Scene *scene, Sampler &sampler) const {
+  // Light reflected by a white Lambertian surface
+  Vector3D wi;
+  float pdf;
+  RGBAColor Li = sample(point, n, sampler, &wi, &pdf);
+  float cosTheta = clipDot(n, wi);
+  if (pdf == 0 || cosTheta == 0 || pointInShadow(point, wi, scene))
     return RGBAColor(0, 0, 0, 1);
-  return emittedLight(wi) * clipDot(n, wi);
+  return Li * (cosTheta * M_1_PI / pdf);
+}
+
+RGBAColor EnvironmentLight::sample(const Vector3D &point, const Vector3D &n, Sampler &sampler, Vector3D *wi, float *pdf) const {
+  if (distribution.empty()) {
+    *wi = sampleHemisphere(n, sampler);
+    *pdf = clipDot(n, *wi) * M_1_PI;
+    return color;
+  }
+
+  float u0 = sampler();
+  float u1 = sampler();
+  if (sampleMap(u0, u1, wi, pdf) == false) {
+    *pdf = 0;
+    return RGBAColor(0, 0, 0, 1);
+  }
+  return emittedLight(*wi, 0.0f);
+}
+
+float EnvironmentLight::pdf(const Vector3D &point, const Vector3D &n, const Vector3D &wi) const {
+  if (distribution.empty())
+    return clipDot(n, normalized(wi)) * M_1_PI;
+  return mapPdf(wi);
 }
 
-RGBAColor EnvironmentLight::emittedLight(const Vector3D &direction) const {
+float EnvironmentLight::power(float sceneRadius) const {
+  float averageLuminance = luminance(color);
+  if (!distribution.empty()) {
+    // The grid covers 2 pi by pi radians and is weighted by sin(phi), which integrates to 4 pi over the sphere
+    averageLuminance = distribution.funcIntegral() * 2.0f * M_PI * M_PI / (4.0f * M_PI);
+  }
+  return M_PI * sceneRadius * sceneRadius * averageLuminance;
+}
+
+// Direction from the origin that sphericalToUV maps to (u * width, v * height / 2) on the luminance map
+static inline Vector3D mapDirection(float u, float v) {
+  float theta = u * 2.0f * M_PI;
+  float phi = v * M_PI;
+  float sinPhi = std::sin(phi);
+  return Vector3D(-sinPhi * std::cos(theta), -sinPhi * std::sin(theta), std::cos(phi));
+}
+
+void EnvironmentLight::buildDistribution() {
+  if (luminanceMap == nullptr || luminanceMap->width() == 0)
+    return;
+
+  // sphericalToUV only reaches half of the map rows, so use one grid row per reachable texel row
+  int nu = luminanceMap->width();
+  int nv = std::max(1, luminanceMap->height() / 2);
+  std::vector<float> values(nu * nv);
+  for (int v = 0; v < nv; ++v) {
+    float vc = (v + 0.5f) / nv;
+    float sinPhi = std::sin(vc * M_PI);
+    for (int u = 0; u < nu; ++u) {
+      const Vector3D mapCoordinates = sphericalToUV(mapDirection((u + 0.5f) / nu, vc), luminanceMap);
+      unsigned x = static_cast<unsigned>(mapCoordinates.x);
+      unsigned y = static_cast<unsigned>(mapCoordinates.y);
+      values[v * nu + u] = luminance(luminanceMap->getPixel(y, x)) * sinPhi;
+    }
+  }
+  distribution = Distribution2D(values.data(), nu, nv);
+}
+
+bool EnvironmentLight::sampleMap(float u0, float u1, Vector3D *direction, float *pdf) const {
+  float uvPdf;
+  std::pair<float, float> uv = distribution.sample(u0, u1, &uvPdf);
+  float sinPhi = std::sin(uv.second * M_PI);
+  if (uvPdf == 0 || sinPhi == 0)
+    return false;
+
+  // Find where the map direction leaves the sphere and look at that point from the center
+  Vector3D d = mapDirection(uv.first, uv.second);
+  float b = dot(d, center);
+  float discriminant = b * b - dot(center, center) + radius * radius;
+  if (discriminant < 0)
+    return false;
+  float s = b + std::sqrt(discriminant);
+  if (s <= 0)
+    return false;
+
+  *direction = (s * d - center) / radius;
+  float cosTheta = dot(d, *direction);
+  *pdf = uvPdf / (2.0f * M_PI * M_PI * sinPhi) * radius * radius * cosTheta / (s * s);
+  return true;
+}
+
+float EnvironmentLight::mapPdf(const Vector3D &direction) const {
+  Vector3D p = center + radius * normalized(direction);
+  float s = magnitude(p);
+  Vector3D d = p / s;
+  float cosTheta = dot(d, normalized(direction));
+  float sinPhi = std::sqrt(std::max(0.0f, 1.0f - d.z * d.z));
+  if (cosTheta <= 0 || sinPhi == 0)
+    return 0;
+
+  float u = (M_PI + std::atan2(d.y, d.x)) * 0.5f * M_1_PI;
+  float v = std::acos(clamp(d.z, -1.0f, 1.0f)) * M_1_PI;
+  float uvPdf = distribution.pdf(u, v);
+  return uvPdf / (2.0f * M_PI * M_PI * sinPhi) * radius * radius * cosTheta / (s * s);
+}
+
+RGBAColor EnvironmentLight::emittedLight(const Vector3D &direction, float spread) const {
   if (luminanceMap == nullptr)
     return color;
   const Vector3D mapCoordinates = sphericalToUV(center + direction * radius, luminanceMap);
   unsigned x = static_cast<unsigned>(mapCoordinates.x);
   unsigned y = static_cast<unsigned>(mapCoordinates.y);
-  return luminanceMap->getPixel(y, x);
+  // the map wraps 2 pi radians around its width
+  return luminanceMap->getPixel(y, x, spread * luminanceMap->width() * 0.5f * M_1_PI);
 }
 
 Sphere::Sphere(
@@ -59,7 +183,7 @@ Sphere::Sphere(
   float r,
   const RGBAColor &color,
   std::shared_ptr<Material> material,
-  std::shared_ptr<PNG> textureMap
+  std::shared_ptr<Texture> textureMap
 )
   : Object(color, material, textureMap), center(center), r(r)
 {
@@ -94,18 +218,23 @@ IntersectionInfo Sphere::intersect(const Vector3D& origin, const Vector3D& direc
   float tOffset = sqrt(radiusSquared - distanceSquared);
   float t = isInsideSphere ? tc + tOffset : tc - tOffset;
 
-  Vector3D intersectionPoint = t * normalizedDirection + origin;
-  return { t, intersectionPoint, normalized(intersectionPoint - center), this };
+  return intersection(t, t * normalizedDirection + origin);
 }
 
-RGBAColor Sphere::getColor(const Vector3D &intersectionPoint) const {
+IntersectionInfo Sphere::intersection(float t, const Vector3D &point) const {
+  return { t, point, normalized(point - center), this };
+}
+
+RGBAColor Sphere::getColor(const Vector3D &intersectionPoint, float footprint) const {
   if (textureMap == nullptr)
     return color;
   
   const Vector3D textureCoordinates = sphericalToUV(intersectionPoint - center, textureMap);
   unsigned x = static_cast<unsigned>(textureCoordinates.x);
   unsigned y = static_cast<unsigned>(textureCoordinates.y);
-  return textureMap->getPixel(y, x);
+  // the texture wraps around the circumference of the sphere
+  float texelsPerUnit = textureMap->width() * 0.5f * M_1_PI / r;
+  return textureMap->getPixel(y, x, footprint * texelsPerUnit);
 }
 
 Plane::Plane(
@@ -116,7 +245,7 @@ Plane::Plane(
   const Vector3D &textureTopLeft,
   float textureZoom,
   const Vector3D &textureShift,
-  std::shared_ptr<PNG> textureMap
+  std::shared_ptr<Texture> textureMap
 )
   : Object(color, material, textureMap), normal(normalized(normal)),
     textureTopLeft(textureTopLeft), textureZoom(textureZoom), textureShift(textureShift)
@@ -140,11 +269,13 @@ IntersectionInfo Plane::intersect(const Vector3D& origin, const Vector3D& direct
   : IntersectionInfo{ t, t * normalizedDirection + origin, normal, this };
 }
 
-RGBAColor Plane::getColor(const Vector3D &intersectionPoint) const {
+RGBAColor Plane::getColor(const Vector3D &intersectionPoint, float footprint) const {
   if (textureMap == nullptr)
     return color;
 
   Vector3D transformedPoint = transformToWorld(intersectionPoint.y, intersectionPoint.x, intersectionPoint.z, Vector3D(0, 0, 1));
+  // texture coordinates are divided by depth, so texels shrink with distance from the plane origin
+  float texelsPerUnit = textureZoom / std::abs(transformedPoint.z);
   transformedPoint = transformedPoint / transformedPoint.z;
   float x = textureZoom * (transformedPoint.x - textureTopLeft.x) + textureShift.x;
   float y = textureZoom * (transformedPoint.y - textureTopLeft.y) + textureShift.y;
@@ -154,7 +285,7 @@ RGBAColor Plane::getColor(const Vector3D &intersectionPoint) const {
   y = y > 0 ? std::fmod(y, height) : height - std::fmod(-y, height);
   x = clamp(x, 0, width - 1);
   y = clamp(height - y, 0, height - 1);
-  return textureMap->getPixel(y, x);
+  return textureMap->getPixel(y, x, footprint * texelsPerUnit);
 }
 
 Triangle::Triangle(
@@ -166,7 +297,7 @@ Triangle::Triangle(
   const Vector3D &t1,
   const Vector3D &t2,
   const Vector3D &t3,
-  std::shared_ptr<PNG> textureMap
+  std::shared_ptr<Texture> textureMap
 )
   : Object(color, material, textureMap), p1(p1), t1(t1), t2(t2), t3(t3)
 {
@@ -183,7 +314,9 @@ Triangle::Triangle(
   Vector3D p3p1Diff = p3 - p1;
   Vector3D p2p1Diff = p2 - p1;
 
-  normal = normalized(cross(p2p1Diff, p3p1Diff));
+  Vector3D scaledNormal = cross(p2p1Diff, p3p1Diff);
+  area = 0.5f * magnitude(scaledNormal);
+  normal = normalized(scaledNormal);
 
   Vector3D a1 = cross(p3p1Diff, normal);
   Vector3D a2 = cross(p2p1Diff, normal);
@@ -209,18 +342,30 @@ IntersectionInfo Triangle::intersect(const Vector3D& origin, const Vector3D& dir
 
   return (b1 < 0 || b1 > 1 || b2 < 0 || b2 > 1 || b3 < 0 || b3 > 1)
   ? IntersectionInfo{ INF_D, Vector3D(), Vector3D(), nullptr }
-  : IntersectionInfo{ t, intersectionPoint, normalized(n1 * b1 + n2 * b2 + n3 * b3), this };
+  : intersection(t, intersectionPoint, b2, b3);
+}
+
+IntersectionInfo Triangle::intersection(float t, const Vector3D &point, float b2, float b3) const {
+  float b1 = 1.0f - b3 - b2;
+  return { t, point, normalized(n1 * b1 + n2 * b2 + n3 * b3), this };
 }
 
-RGBAColor Triangle::getColor(const Vector3D &intersectionPoint) const {
+RGBAColor Triangle::getColor(const Vector3D &intersectionPoint, float footprint) const {
   if (textureMap == nullptr)
     return color;
+  // Degenerate triangles have no area for barycentrics or the texture footprint, so they use their first
+  // texture coordinate at full resolution
+  if (area <= 0)
+    return textureMap->getPixel(t1.y, t1.x, 0.0f);
   
   float b2 = dot(e1, intersectionPoint - p1);
   float b3 = dot(e2, intersectionPoint - p1);
   float b1 = 1.0f - b3 - b2;
   Vector3D textureCoordinates = t1 * b1 + t2 * b2 + t3 * b3;
-  return textureMap->getPixel(textureCoordinates.y, textureCoordinates.x);
+  // ratio of the area covered in the texture to the area of the triangle
+  float textureArea = 0.5f * magnitude(cross(t2 - t1, t3 - t1));
+  float texelsPerUnit = std::sqrt(textureArea / area);
+  return textureMap->getPixel(textureCoordinates.y, textureCoordinates.x, footprint * texelsPerUnit);
 }
 
 void Triangle::setTextureCoordinates(const Vector3D &tex1, const Vector3D &tex2, const Vector3D &tex3) {
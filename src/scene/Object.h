@@ -6,6 +6,8 @@
 #include "../macros.h"
 #include "../vector/vector3d.h"
 #include "../image/PNG.h"
+#include "../image/Texture.h"
+#include "../bsdf/Distribution.h"
 
 class Object;
 class Scene;
@@ -35,16 +37,22 @@ enum class ObjectType {
 class Object {
 public:
   virtual ~Object() {};
-  Object(const RGBAColor &color, std::shared_ptr<Material> material, std::shared_ptr<PNG> textureMap)
+  Object(const RGBAColor &color, std::shared_ptr<Material> material, std::shared_ptr<Texture> textureMap)
     : color(color), material(material), textureMap(textureMap) {};
   virtual IntersectionInfo intersect(const Vector3D& origin, const Vector3D& direction) const = 0;
-  virtual RGBAColor getColor(const Vector3D &intersectionPoint) const {
+  /**
+   * getColor
+   * 
+   * intersectionPoint - point on the object to get the color of
+   * footprint         - width of the ray footprint on the surface in world units; picks the texture mip level
+  */
+  virtual RGBAColor getColor(const Vector3D &intersectionPoint, float footprint) const {
     return color;
   }
 
   RGBAColor color;
   std::shared_ptr<Material> material;
-  std::shared_ptr<PNG> textureMap;
+  std::shared_ptr<Texture> textureMap;
   Vector3D aabbMin;
   Vector3D aabbMax;
   Vector3D centroid;
@@ -57,10 +65,63 @@ public:
     : color(color) {};
   virtual ~Light() {};
   virtual bool pointInShadow(const Vector3D &point, const Vector3D &direction, const Scene *scene) const = 0;
-  virtual RGBAColor intensity(const Vector3D &point, const Vector3D &n, const Scene *scene, UniformDistribution &sampler) const = 0;
-  virtual RGBAColor emittedLight(const Vector3D &point) const {
+  virtual RGBAColor intensity(const Vector3D &point, const Vector3D &n, const Scene *scene, Sampler &sampler) const = 0;
+  /**
+   * emittedLight
+   * 
+   * direction - direction of a ray that escaped the scene
+   * spread    - angle subtended by the ray footprint; picks the luminance map mip level
+  */
+  virtual RGBAColor emittedLight(const Vector3D &direction, float spread) const {
     return RGBAColor(0,0,0,0);
   }
+  /**
+   * power
+   * 
+   * Estimate of the total light given off, used to pick which lights to sample.
+   * 
+   * sceneRadius - radius of a sphere around every object, for lights that are infinitely far away
+  */
+  virtual float power(float sceneRadius) const = 0;
+  /**
+   * isDelta - true for lights that arrive from a single direction, which BSDF sampling can never hit.
+  */
+  virtual bool isDelta() const {
+    return true;
+  }
+  /**
+   * sample
+   * 
+   * Samples a direction towards the light for lights that are not delta lights. Returns the unoccluded
+   * light arriving at point from wi.
+   * 
+   * point - point being lit
+   * n     - surface normal at point
+   * wi    - filled with the sampled direction
+   * pdf   - filled with the solid angle density of wi, or 0 if no direction was found
+  */
+  virtual RGBAColor sample(const Vector3D &point, const Vector3D &n, Sampler &sampler, Vector3D *wi, float *pdf) const {
+    *pdf = 0;
+    return RGBAColor(0, 0, 0, 1);
+  }
+  /**
+   * pdf - solid angle density of sample returning wi, for weighting against BSDF sampling.
+  */
+  virtual float pdf(const Vector3D &point, const Vector3D &n, const Vector3D &wi) const {
+    return 0;
+  }
+  /**
+   * sampleDelta
+   * 
+   * For delta lights, the unoccluded light arriving at point. intensity is this light unless
+   * pointInShadow(point, *wi, scene) is true.
+   * 
+   * wi - filled with the direction to test for occlusion
+  */
+  virtual RGBAColor sampleDelta(const Vector3D &point, const Vector3D &n, Vector3D *wi) const {
+    *wi = n;
+    return RGBAColor(0, 0, 0, 1);
+  }
 
   RGBAColor color;
 };
@@ -71,7 +132,9 @@ public:
     : Light(color), direction(direction) {};
   ~DistantLight() {};
   bool pointInShadow(const Vector3D &point, const Vector3D &direction, const Scene *scene) const;
-  RGBAColor intensity(const Vector3D &point, const Vector3D &n, const Scene *scene, UniformDistribution &sampler) const;
+  RGBAColor intensity(const Vector3D &point, const Vector3D &n, const Scene *scene, Sampler &sampler) const;
+  RGBAColor sampleDelta(const Vector3D &point, const Vector3D &n, Vector3D *wi) const;
+  float power(float sceneRadius) const;
 
   Vector3D direction;
 };
@@ -82,26 +145,68 @@ public:
     : Light(color), center(center) {};
   ~PointLight() {};
   bool pointInShadow(const Vector3D &point, const Vector3D &direction, const Scene *scene) const;
-  RGBAColor intensity(const Vector3D &point, const Vector3D &n, const Scene *scene, UniformDistribution &sampler) const;
+  RGBAColor intensity(const Vector3D &point, const Vector3D &n, const Scene *scene, Sampler &sampler) const;
+  RGBAColor sampleDelta(const Vector3D &point, const Vector3D &n, Vector3D *wi) const;
+  float power(float sceneRadius) const;
 
   Vector3D center;
 };
 
+/**
+ * class EnvironmentLight
+ *
+ * Light arriving from a sphere of the given radius around center, either a constant color or
+ * looked up in a luminance map. Luminance maps are importance sampled from a piecewise-constant
+ * distribution over the map, constant colors are sampled over the cosine weighted hemisphere.
+ * The renderer weights these samples against BSDF sampling, while intensity uses them on their own.
+ *
+ * private members:
+ *  distribution - distribution over the (u, v) coordinates of the luminance map, proportional to luminance * sin(phi)
+*/
 class EnvironmentLight : public Light {
 public:
   EnvironmentLight(const Vector3D &center, float radius, const RGBAColor &color)
     : Light(color), center(center), radius(radius), luminanceMap(nullptr) {};
-    EnvironmentLight(const Vector3D &center, float radius, float scale, std::shared_ptr<PNG> luminanceMap)
+    EnvironmentLight(const Vector3D &center, float radius, float scale, std::shared_ptr<Texture> luminanceMap)
     : Light(RGBAColor()), center(center), radius(radius), scale(scale), luminanceMap(luminanceMap) {};
   ~EnvironmentLight() {};
   bool pointInShadow(const Vector3D &point, const Vector3D &direction, const Scene *scene) const;
-  RGBAColor intensity(const Vector3D &point, const Vector3D &n, const Scene *scene, UniformDistribution &sampler) const;
-  RGBAColor emittedLight(const Vector3D &point) const;
+  RGBAColor intensity(const Vector3D &point, const Vector3D &n, const Scene *scene, Sampler &sampler) const;
+  RGBAColor emittedLight(const Vector3D &direction, float spread) const;
+  float power(float sceneRadius) const;
+  bool isDelta() const {
+    return false;
+  }
+  RGBAColor sample(const Vector3D &point, const Vector3D &n, Sampler &sampler, Vector3D *wi, float *pdf) const;
+  float pdf(const Vector3D &point, const Vector3D &n, const Vector3D &wi) const;
+  /**
+   * buildDistribution - tabulates the luminance map for importance sampling. Must be called once the map has loaded.
+  */
+  void buildDistribution();
 
   Vector3D center;
   float radius;
   float scale;
-  std::shared_ptr<PNG> luminanceMap;
+  std::shared_ptr<Texture> luminanceMap;
+
+private:
+  /**
+   * sampleMap
+   *
+   * Samples a direction proportional to the luminance map. Returns false if the sampled
+   * texel cannot be seen from inside the sphere.
+   *
+   * u0, u1    - uniform samples
+   * direction - filled with the sampled direction
+   * pdf       - filled with the solid angle density of direction
+  */
+  bool sampleMap(float u0, float u1, Vector3D *direction, float *pdf) const;
+  /**
+   * mapPdf - solid angle density of sampleMap returning direction.
+  */
+  float mapPdf(const Vector3D &direction) const;
+
+  Distribution2D distribution;
 };
 
 class Sphere : public Object {
@@ -111,11 +216,16 @@ public:
     float r,
     const RGBAColor &color,
     std::shared_ptr<Material> material,
-    std::shared_ptr<PNG> textureMap=nullptr
+    std::shared_ptr<Texture> textureMap=nullptr
   );
   IntersectionInfo intersect(const Vector3D& origin, const Vector3D& direction) const;
-  RGBAColor getColor(const Vector3D &intersectionPoint) const;
+  /**
+   * intersection - hit at distance t and point, found by intersect or by the BVH leaf kernel.
+  */
+  IntersectionInfo intersection(float t, const Vector3D &point) const;
+  RGBAColor getColor(const Vector3D &intersectionPoint, float footprint) const;
 
+  // Also packed in the BVH arena, where rays test them
   Vector3D center;
   float r;
 };
@@ -130,10 +240,10 @@ public:
     const Vector3D &textureTopLeft=Vector3D(),
     float textureZoom=1.0f,
     const Vector3D &textureShift=Vector3D(),
-    std::shared_ptr<PNG> textureMap=nullptr
+    std::shared_ptr<Texture> textureMap=nullptr
   );
   IntersectionInfo intersect(const Vector3D& origin, const Vector3D& direction) const;
-  RGBAColor getColor(const Vector3D &intersectionPoint) const;
+  RGBAColor getColor(const Vector3D &intersectionPoint, float footprint) const;
 
   Vector3D normal;
   Vector3D point;
@@ -153,17 +263,25 @@ public:
     const Vector3D &t1=Vector3D(),
     const Vector3D &t2=Vector3D(),
     const Vector3D &t3=Vector3D(),
-    std::shared_ptr<PNG> textureMap=nullptr
+    std::shared_ptr<Texture> textureMap=nullptr
   );
   IntersectionInfo intersect(const Vector3D& origin, const Vector3D& direction) const;
-  RGBAColor getColor(const Vector3D &intersectionPoint) const;
+  /**
+   * intersection - hit at distance t and point with barycentric coordinates b2 and b3, found by intersect
+   * or by the BVH leaf kernel.
+  */
+  IntersectionInfo intersection(float t, const Vector3D &point, float b2, float b3) const;
+  RGBAColor getColor(const Vector3D &intersectionPoint, float footprint) const;
   void setTextureCoordinates(const Vector3D &tex1, const Vector3D &tex2, const Vector3D &tex3);
 
+  // Intersection data. BVH leaf tests use the copies packed in its arena, but Object::intersect and texture
+  // lookups in getColor still read these
   Vector3D p1;
   Vector3D normal;
   Vector3D e1;
   Vector3D e2;
 
+  // Shading data, read once a ray's nearest hit is known
   Vector3D t1;
   Vector3D t2;
   Vector3D t3;
@@ -171,4 +289,6 @@ public:
   Vector3D n1;
   Vector3D n2;
   Vector3D n3;
+
+  float area;
 };
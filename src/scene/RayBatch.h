@@ -0,0 +1,118 @@
+#pragma once
+
+#include "../macros.h"
+#include "../vector/vector3d.h"
+
+class Object;
+
+// Rays each worker of a batch query takes at a time, a multiple of 64 so workers never share a word of a Bitmask
+#define RAY_BATCH_CHUNK_SIZE 4096
+
+/**
+ * RayBatch struct
+ *
+ * Rays queried together through Scene::intersect or Scene::occluded. Like IntersectionInfo::t, distances
+ * along a ray are measured in world units whatever the length of its direction, so a segment from a to b
+ * is origin a, direction b - a and maxT |b - a|.
+ *
+ * origin    - ray origins
+ * direction - ray directions, not necessarily normalized
+ * maxT      - distance from the origin each ray ends at
+*/
+struct RayBatch {
+  Vector3DArray origin;
+  Vector3DArray direction;
+  std::vector<float> maxT;
+
+  size_t size() const {
+    return maxT.size();
+  }
+
+  void push_back(const Vector3D &o, const Vector3D &d, float tMax=INF_D) {
+    origin.push_back(o);
+    direction.push_back(d);
+    maxT.push_back(tMax);
+  }
+
+  void clear() {
+    origin.clear();
+    direction.clear();
+    maxT.clear();
+  }
+};
+
+/**
+ * HitBatch struct
+ *
+ * Closest hits of the rays of a RayBatch, in the same order. Rays that hit nothing have t INF_D and
+ * obj nullptr.
+ *
+ * t      - distance from the ray origin to each hit
+ * point  - hit points
+ * normal - surface normals at the hits
+ * obj    - objects hit
+*/
+struct HitBatch {
+  std::vector<float> t;
+  Vector3DArray point;
+  Vector3DArray normal;
+  std::vector<const Object *> obj;
+
+  size_t size() const {
+    return t.size();
+  }
+
+  void resize(size_t n) {
+    t.resize(n);
+    point.resize(n);
+    normal.resize(n);
+    obj.resize(n);
+  }
+};
+
+/**
+ * class Bitmask
+ *
+ * One bit per ray of a batch, packed 64 to a word.
+ *
+ * private members:
+ *  bits  - packed bits, lowest bit first
+ *  count - number of bits in use
+*/
+class Bitmask {
+public:
+  size_t size() const {
+    return count;
+  }
+
+  /**
+   * resize - holds n bits, all cleared.
+  */
+  void resize(size_t n) {
+    count = n;
+    bits.assign((n + 63) / 64, 0);
+  }
+
+  bool operator[](size_t i) const {
+    return (bits[i / 64] >> (i % 64)) & 1;
+  }
+
+  void set(size_t i) {
+    bits[i / 64] |= uint64_t(1) << (i % 64);
+  }
+
+  /**
+   * popcount - number of set bits.
+  */
+  size_t popcount() const {
+    size_t total = 0;
+    for (uint64_t word : bits) {
+      total += std::bitset<64>(word).count();
+    }
+    return total;
+  }
+
+private:
+  std::vector<uint64_t> bits;
+  size_t count = 0;
+};
@@ -0,0 +1,331 @@
+#include "Wavefront.h"
+#include "Object.h"
+#include "Material.h"
+
+#include "../bsdf/math_utils.h"
+
+#define SPECULAR_FLAG  1
+#define CAN_SPLIT_FLAG 2
+// Bits per axis of the origin's Morton code when sorting rays
+#define MORTON_BITS 10
+
+// Spreads the low 10 bits of v out to every third bit
+static inline uint32_t expandBits(uint32_t v) {
+  v = (v * 0x00010001u) & 0xFF0000FFu;
+  v = (v * 0x00000101u) & 0x0F00F00Fu;
+  v = (v * 0x00000011u) & 0xC30C30C3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+uint32_t Wavefront::addCameraRay(uint32_t pixelIndex, uint32_t sample, const Vector3D &origin, const Vector3D &direction, RayCone cone) {
+  uint32_t path = pixel.size();
+  pixel.push_back(pixelIndex);
+  sampleIndex.push_back(sample);
+  root.push_back(path);
+  bounce.push_back(0);
+  coneWidth.push_back(cone.width);
+  coneSpread.push_back(cone.spread);
+  beta.push_back(RGBAColor(1, 1, 1, 1));
+  flags.push_back(SPECULAR_FLAG | (scene->options.splitting > 1 ? CAN_SPLIT_FLAG : 0));
+  lastPoint.push_back(Vector3D(0, 0, 0));
+  lastNormal.push_back(Vector3D(0, 0, 0));
+  lastColor.push_back(RGBAColor());
+  lastPdf.push_back(0.0f);
+  dimensionOffset.push_back(0);
+  radiance.push_back(RGBAColor(0, 0, 0, 0));
+
+  rays.push_back(origin, direction, path);
+  return path;
+}
+
+uint32_t Wavefront::addPath(uint32_t path) {
+  uint32_t branch = pixel.size();
+  pixel.push_back(pixel[path]);
+  sampleIndex.push_back(sampleIndex[path]);
+  root.push_back(root[path]);
+  bounce.push_back(bounce[path]);
+  coneWidth.push_back(coneWidth[path]);
+  coneSpread.push_back(coneSpread[path]);
+  beta.push_back(beta[path]);
+  flags.push_back(flags[path]);
+  lastPoint.push_back(lastPoint[path]);
+  lastNormal.push_back(lastNormal[path]);
+  lastColor.push_back(lastColor[path]);
+  lastPdf.push_back(lastPdf[path]);
+  dimensionOffset.push_back(dimensionOffset[path]);
+  radiance.push_back(RGBAColor(0, 0, 0, 0));
+  return branch;
+}
+
+void Wavefront::clear() {
+  rays.clear();
+  nextRays.clear();
+  hits.clear();
+  shadows.clear();
+
+  pixel.clear();
+  sampleIndex.clear();
+  root.clear();
+  bounce.clear();
+  coneWidth.clear();
+  coneSpread.clear();
+  beta.clear();
+  flags.clear();
+  lastPoint.clear();
+  lastNormal.clear();
+  lastColor.clear();
+  lastPdf.clear();
+  dimensionOffset.clear();
+  radiance.clear();
+}
+
+uint64_t Wavefront::takeSegments() {
+  uint64_t traced = segments;
+  segments = 0;
+  return traced;
+}
+
+void Wavefront::startSample(uint32_t path, uint32_t dimension) {
+  sampler.startSample(scene->seed, pixel[path], sampleIndex[path]);
+  sampler.setDimension(dimension);
+}
+
+void Wavefront::trace() {
+  while (rays.size() > 0) {
+    if (scene->options.sortRays)
+      sortRays();
+    extend();
+
+    hits.order.resize(hits.size());
+    std::iota(hits.order.begin(), hits.order.end(), 0);
+    if (scene->options.sortHits)
+      sortHits();
+    for (uint32_t hit : hits.order) {
+      shade(hit);
+    }
+    shadow();
+
+    std::swap(rays, nextRays);
+    nextRays.clear();
+    hits.clear();
+    shadows.clear();
+  }
+
+  // Branches are created together in the order they were split, so every camera ray sums them the same way
+  for (uint32_t path = 0; path < radiance.size(); ++path) {
+    if (root[path] != path)
+      radiance[root[path]] += radiance[path];
+  }
+}
+
+void Wavefront::sortRays() {
+  size_t n = rays.size();
+  if (n < 2)
+    return;
+
+  float lo[3] = { INF_D, INF_D, INF_D };
+  float hi[3] = { -INF_D, -INF_D, -INF_D };
+  const std::vector<float> *origin[3] = { &rays.origin.x, &rays.origin.y, &rays.origin.z };
+  for (int axis = 0; axis < 3; ++axis) {
+    for (float v : *origin[axis]) {
+      lo[axis] = std::min(lo[axis], v);
+      hi[axis] = std::max(hi[axis], v);
+    }
+  }
+
+  // Rays going the same way from nearby origins visit the same nodes, so sort by direction octant and then
+  // by where the origin falls on a Morton curve over the queue's bounds
+  float cells = (1 << MORTON_BITS) - 1;
+  sortKeys.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    uint32_t code = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+      float extent = hi[axis] - lo[axis];
+      float t = (extent > 0) ? ((*origin[axis])[i] - lo[axis]) / extent : 0.0f;
+      code |= expandBits(static_cast<uint32_t>(t * cells)) << axis;
+    }
+    uint32_t octant = (rays.direction.x[i] < 0) | (rays.direction.y[i] < 0) << 1 | (rays.direction.z[i] < 0) << 2;
+    sortKeys[i] = static_cast<uint64_t>(octant) << 32 | code;
+  }
+
+  std::vector<uint32_t> order(n);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+    return sortKeys[a] < sortKeys[b];
+  });
+
+  nextRays.origin.gather(rays.origin, order);
+  nextRays.direction.gather(rays.direction, order);
+  nextRays.path.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    nextRays.path[i] = rays.path[order[i]];
+  }
+  std::swap(rays, nextRays);
+  nextRays.clear();
+}
+
+void Wavefront::extend() {
+  int numLights = scene->lights.size();
+  for (size_t i = 0; i < rays.size(); ++i) {
+    uint32_t path = rays.path[i];
+    Vector3D origin = rays.origin[i];
+    Vector3D direction = rays.direction[i];
+    IntersectionInfo info = scene->findClosestObject(origin, direction);
+    ++segments;
+
+    if (info.obj == nullptr) {
+      // Add environment lighting on miss, weighted against light sampling at the last hit like Scene::tracePath
+      for (int l = 0; l < numLights; ++l) {
+        const Light *light = scene->lights[l];
+        if (flags[path] & SPECULAR_FLAG) {
+          radiance[path] += beta[path] * light->emittedLight(direction, coneSpread[path]);
+        } else if (!light->isDelta()) {
+          RGBAColor Le = light->emittedLight(direction, 0.0f);
+          float lightPdf = scene->lightSampleCount(l) * light->pdf(lastPoint[path], lastNormal[path], direction);
+          radiance[path] += beta[path] * lastColor[path] * Le * powerHeuristic(lastPdf[path], lightPdf);
+        }
+      }
+      continue;
+    }
+
+    coneWidth[path] += coneSpread[path] * magnitude(info.point - origin);
+    hits.path.push_back(path);
+    hits.point.push_back(info.point);
+    hits.normal.push_back(info.normal);
+    hits.wo.push_back(-normalized(direction));
+    hits.obj.push_back(info.obj);
+  }
+}
+
+void Wavefront::sortHits() {
+  // Stable, so hits of the same material keep the ray order
+  std::stable_sort(hits.order.begin(), hits.order.end(), [this](uint32_t a, uint32_t b) {
+    return hits.obj[a]->material.get() < hits.obj[b]->material.get();
+  });
+}
+
+void Wavefront::shade(uint32_t hit) {
+  const SceneOptions &options = scene->options;
+  uint32_t path = hits.path[hit];
+  uint32_t bounceDimensions = scene->bounceDimensions();
+  uint32_t dimension = CAMERA_DIMENSIONS + dimensionOffset[path] + bounce[path] * bounceDimensions;
+
+  IntersectionInfo info{ 0.0f, hits.point[hit], hits.normal[hit], hits.obj[hit] };
+  Vector3D point = info.point;
+  Vector3D wo = hits.wo[hit];
+  Vector3D outNormal = faceForward(wo, info.normal);
+  info.point += options.bias * outNormal;
+  const std::shared_ptr<Material> &material = info.obj->material;
+
+  float footprint = coneWidth[path] / std::max(std::abs(dot(wo, info.normal)), 0.01f);
+  RGBAColor surfaceColor = info.obj->getColor(info.point, footprint);
+  // Surfaces count towards the pixel's coverage even when every light is blocked
+  radiance[path].a = 1.0f;
+
+  // Queue the same light samples as Scene::illuminate
+  RGBAColor weight = beta[path] * surfaceColor;
+  uint32_t lightDimension = dimension + BSDF_DIMENSIONS + ROULETTE_DIMENSIONS;
+  if (scene->lightDistribution.count() == 0) {
+    for (size_t l = 0; l < scene->lights.size(); ++l) {
+      startSample(path, lightDimension + l * LIGHT_DIMENSIONS);
+      queueLightSample(path, l, info, wo, weight);
+    }
+  } else {
+    float invLightSamples = 1.0f / options.lightSamples;
+    for (int i = 0; i < options.lightSamples; ++i) {
+      startSample(path, lightDimension + i * LIGHT_DIMENSIONS);
+      float pmf;
+      int light = scene->lightDistribution.sample(sampler(), &pmf);
+      queueLightSample(path, light, info, wo, weight * (invLightSamples / pmf));
+    }
+  }
+
+  lastPoint.set(path, info.point);
+  lastNormal.set(path, info.normal);
+  lastColor[path] = surfaceColor;
+  if (material->type == MaterialType::Metal) {
+    beta[path] *= info.obj->color;
+    lastColor[path] = RGBAColor(1, 1, 1, 1);
+  }
+  // The last bounce only gathers light
+  if (bounce[path] + 1 >= options.maxBounces)
+    return;
+
+  int splits = 1;
+  if ((flags[path] & CAN_SPLIT_FLAG) && material->type != MaterialType::Glass && material->type != MaterialType::Mirror) {
+    float throughput = std::max({ beta[path].r, beta[path].g, beta[path].b });
+    splits = std::clamp(static_cast<int>(std::ceil(options.splitting * std::min(throughput, 1.0f))), 1, options.splitting);
+    flags[path] &= ~CAN_SPLIT_FLAG;
+  }
+
+  for (int branch = splits - 1; branch >= 0; --branch) {
+    uint32_t branchOffset = branch * options.maxBounces * bounceDimensions;
+
+    float pdf = 0.0f;
+    BDFType type{};
+    Vector3D wi;
+    startSample(path, dimension + branchOffset);
+    float contribution = material->bsdf.sampleFunc(wo, &wi, info.normal, sampler, &pdf, &type);
+    if (pdf == 0 || contribution == 0)
+      continue;
+
+    RGBAColor nextBeta = beta[path] * (contribution * std::abs(dot(wi, info.normal)) / pdf);
+    if (bounce[path] + 1 >= options.rouletteDepth) {
+      float survival = std::min(std::max({ nextBeta.r, nextBeta.g, nextBeta.b }), 1.0f);
+      if (survival < 1.0f) {
+        startSample(path, dimension + BSDF_DIMENSIONS + branchOffset);
+        if (sampler() >= survival)
+          continue;
+        nextBeta = nextBeta / survival;
+      }
+    }
+
+    uint32_t next = (branch == 0) ? path : addPath(path);
+    dimensionOffset[next] += branchOffset;
+    beta[next] = nextBeta / splits;
+    lastPdf[next] = pdf;
+    ++bounce[next];
+    bool specular = static_cast<bool>(type & BDFType::PERFECT_SPECULAR);
+    if (!specular)
+      coneSpread[next] += 2.0f * std::sqrt(1.0f / (M_PI * pdf));
+    flags[next] = (flags[next] & ~SPECULAR_FLAG) | (specular ? SPECULAR_FLAG : 0);
+
+    bool exiting = dot(wi, outNormal) > 0;
+    nextRays.push_back(point + outNormal * (exiting ? options.bias : -options.bias), wi, next);
+  }
+}
+
+void Wavefront::queueLightSample(uint32_t path, int i, const IntersectionInfo &info, const Vector3D &wo, const RGBAColor &weight) {
+  const Light *light = scene->lights[i];
+  Vector3D wi;
+  RGBAColor Li;
+  if (light->isDelta()) {
+    Li = light->sampleDelta(info.point, info.normal, &wi);
+  } else {
+    float lightPdf;
+    Li = light->sample(info.point, info.normal, sampler, &wi, &lightPdf);
+    if (lightPdf == 0)
+      return;
+
+    const BSDF &bsdf = info.obj->material->bsdf;
+    float f = bsdf.func(wo, wi, info.normal);
+    if (f == 0)
+      return;
+    float misWeight = powerHeuristic(scene->lightSampleCount(i) * lightPdf, bsdf.pdf(wo, wi, info.normal));
+    Li = Li * (f * std::abs(dot(wi, info.normal)) * misWeight / lightPdf);
+  }
+  if (Li.r == 0 && Li.g == 0 && Li.b == 0)
+    return;
+
+  shadows.rays.push_back(info.point, wi, path);
+  shadows.light.push_back(i);
+  shadows.radiance.push_back(weight * Li);
+}
+
+void Wavefront::shadow() {
+  for (size_t i = 0; i < shadows.rays.size(); ++i) {
+    if (!scene->lights[shadows.light[i]]->pointInShadow(shadows.rays.origin[i], shadows.rays.direction[i], scene))
+      radiance[shadows.rays.path[i]] += shadows.radiance[i];
+  }
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include "raytracer.h"
+
+#include "../macros.h"
+#include "../image/PNG.h"
+#include "../vector/vector3d.h"
+#include "../bsdf/Sampler.h"
+
+// Camera rays each worker traces together. Sorting finds more coherence in larger batches, at the cost of
+// queues that no longer fit in cache.
+#define WAVEFRONT_BATCH_SIZE 16384
+
+/**
+ * RayQueue struct
+ *
+ * Rays waiting to be traced by a stage of the wavefront integrator.
+ *
+ * origin    - ray origins
+ * direction - ray directions
+ * path      - path each ray belongs to
+*/
+struct RayQueue {
+  Vector3DArray origin;
+  Vector3DArray direction;
+  std::vector<uint32_t> path;
+
+  size_t size() const {
+    return path.size();
+  }
+
+  void push_back(const Vector3D &o, const Vector3D &d, uint32_t pathIndex) {
+    origin.push_back(o);
+    direction.push_back(d);
+    path.push_back(pathIndex);
+  }
+
+  void clear() {
+    origin.clear();
+    direction.clear();
+    path.clear();
+  }
+};
+
+/**
+ * HitQueue struct
+ *
+ * Closest hits found by the extend stage, waiting to be shaded.
+ *
+ * path   - path whose ray found the hit
+ * point  - hit point, before offsetting
+ * normal - surface normal at the hit
+ * wo     - normalized direction back along the ray
+ * obj    - object that was hit
+ * order  - order to shade the hits in
+*/
+struct HitQueue {
+  std::vector<uint32_t> path;
+  Vector3DArray point;
+  Vector3DArray normal;
+  Vector3DArray wo;
+  std::vector<const Object *> obj;
+  std::vector<uint32_t> order;
+
+  size_t size() const {
+    return path.size();
+  }
+
+  void clear() {
+    path.clear();
+    point.clear();
+    normal.clear();
+    wo.clear();
+    obj.clear();
+    order.clear();
+  }
+};
+
+/**
+ * ShadowQueue struct
+ *
+ * Light samples waiting on their shadow rays.
+ *
+ * rays     - shadow rays, with path set to the path the light is added to
+ * light    - light each ray tests occlusion for
+ * radiance - light added to the path when the ray isn't occluded
+*/
+struct ShadowQueue {
+  RayQueue rays;
+  std::vector<int> light;
+  std::vector<RGBAColor> radiance;
+
+  void clear() {
+    rays.clear();
+    light.clear();
+    radiance.clear();
+  }
+};
+
+/**
+ * class Wavefront
+ *
+ * Wavefront path tracer. Rather than following one path at a time like Scene::raytrace, it advances a
+ * whole batch of paths one bounce at a time in stages, each running over every path in queues laid out as
+ * structures of arrays:
+ *
+ *  extend - traces the ray queue, adding environment light to paths that escape and queueing hits
+ *  shade  - samples lights at each hit into the shadow queue, and samples the BSDF into the next ray queue
+ *  shadow - traces the shadow queue, adding the light of unoccluded samples
+ *
+ * Before extend, rays are sorted by direction octant and then origin so neighbouring rays visit the same
+ * BVH nodes, and before shade, hits are sorted by material so consecutive hits run the same BSDF code. The
+ * sampler is restarted from each path's pixel and sample index, so paths take the same numbers as in
+ * Scene::raytrace and the image doesn't depend on how paths are batched.
+ *
+ * private members:
+ *  scene            - scene being rendered
+ *  sampler          - restarted for every path before it draws
+ *  rays, nextRays   - rays of the current bounce and the rays continuing the paths
+ *  hits, shadows    - queues of the current bounce
+ *  sortKeys         - scratch space for sorting rays
+ *  pixel            - pixel the sampler of each path is keyed by
+ *  sampleIndex      - sample index the sampler of each path is keyed by
+ *  root             - camera ray each path was split from, or its own index for camera rays
+ *  bounce           - bounce of each path's next ray
+ *  coneWidth        - footprint of each path's next ray
+ *  coneSpread       - angle each path's footprint widens by per unit distance
+ *  beta             - throughput of each path
+ *  flags            - whether each path's last bounce was perfectly specular and whether it can still split
+ *  lastPoint        - previous shading point of each path
+ *  lastNormal       - surface normal at lastPoint
+ *  lastColor        - surface color at lastPoint
+ *  lastPdf          - pdf the BSDF at lastPoint sampled each path's next ray with
+ *  dimensionOffset  - added to the sampler dimensions of each path, separating branches of split paths
+ *  radiance         - light carried by each path, summed into its root once the batch is traced
+ *  segments         - rays traced since the last call to takeSegments
+*/
+class Wavefront {
+public:
+  Wavefront(Scene *scene, Sampler &sampler) : scene(scene), sampler(sampler) {};
+
+  /**
+   * addCameraRay - queues a camera ray for sample sampleIndex of pixel. Returns the index of its path.
+  */
+  uint32_t addCameraRay(uint32_t pixel, uint32_t sampleIndex, const Vector3D &origin, const Vector3D &direction, RayCone cone);
+
+  /**
+   * trace - traces every queued path to the end, after which radianceOf returns their light.
+  */
+  void trace();
+
+  /**
+   * radianceOf - light arriving along the camera ray of path, including every branch split from it.
+  */
+  const RGBAColor &radianceOf(uint32_t path) const {
+    return radiance[path];
+  }
+
+  /**
+   * clear - drops every path so a new batch can be queued.
+  */
+  void clear();
+
+  /**
+   * takeSegments - number of rays traced since the last call, not counting shadow rays.
+  */
+  uint64_t takeSegments();
+
+private:
+  /**
+   * addPath - copies the state of path into a new path split off it. Returns the index of the new path.
+  */
+  uint32_t addPath(uint32_t path);
+  void startSample(uint32_t path, uint32_t dimension);
+  void sortRays();
+  void extend();
+  void sortHits();
+  void shade(uint32_t hit);
+  void queueLightSample(uint32_t path, int light, const IntersectionInfo &info, const Vector3D &wo, const RGBAColor &weight);
+  void shadow();
+
+  Scene *scene;
+  Sampler &sampler;
+
+  RayQueue rays;
+  RayQueue nextRays;
+  HitQueue hits;
+  ShadowQueue shadows;
+  std::vector<uint64_t> sortKeys;
+
+  std::vector<uint32_t> pixel;
+  std::vector<uint32_t> sampleIndex;
+  std::vector<uint32_t> root;
+  std::vector<int> bounce;
+  std::vector<float> coneWidth;
+  std::vector<float> coneSpread;
+  std::vector<RGBAColor> beta;
+  std::vector<uint8_t> flags;
+  Vector3DArray lastPoint;
+  Vector3DArray lastNormal;
+  std::vector<RGBAColor> lastColor;
+  std::vector<float> lastPdf;
+  std::vector<uint32_t> dimensionOffset;
+  std::vector<RGBAColor> radiance;
+  uint64_t segments = 0;
+};
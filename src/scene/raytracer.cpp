@@ -1,4 +1,6 @@
 #include "raytracer.h"
+#include "CameraModels.h"
+#include "Wavefront.h"
 
 #include "../macros.h"
 
@@ -18,155 +20,240 @@ float getRayScaleY(float y, int w, int h) {
   return (h - 2 * y) / std::max(w, h);
 }
 
+/**
+ * PathState struct
+ *
+ * Everything a path carries from one bounce to the next. Split paths continue from a copy per branch.
+ *
+ * origin, direction - next ray of the path
+ * cone              - footprint of the next ray
+ * beta              - throughput of the path up to the next ray
+ * isSpecular        - whether the last bounce was perfectly specular, or the ray is a camera ray
+ * canSplit          - whether the path may still be split at a rough bounce
+ * lastInfo          - previous shading point, so escaping rays can be weighted against light sampling there
+ * lastColor         - surface color at lastInfo
+ * lastPdf           - pdf the BSDF at lastInfo sampled the next ray with
+ * dimensionOffset   - added to the sampler dimensions of every bounce, separating the branches of split paths
+*/
+struct PathState {
+  Vector3D origin;
+  Vector3D direction;
+  RayCone cone;
+  RGBAColor beta;
+  bool isSpecular;
+  bool canSplit;
+  IntersectionInfo lastInfo;
+  RGBAColor lastColor;
+  float lastPdf;
+  uint32_t dimensionOffset;
+};
+
 Scene::~Scene() {
   for (auto it = lights.begin(); it != lights.end(); ++it) {
     delete *it;
   }
 }
 
-void Scene::threadTaskDefault(PNG *img, SafeQueue<RenderTask> *tasks, SafeProgressBar *counter) {
-  RenderTask task;
-  int finishedPixels = 0;
+int Scene::maxSamplesPerPixel() const {
+  return (options.adaptiveThreshold > 0) ? std::max(options.numRays, options.maxRays) : options.numRays;
+}
 
-  float invNumRays = 1.0 / options.numRays;
-  int allowAntiAliasing = std::min(1, options.numRays - 1);
-  UniformDistribution sampler(std::mt19937(), std::uniform_real_distribution<float>(0, 1.0));
+// Set from signal handlers, so these must be lock free
+static std::atomic<bool> terminateRequested(false);
+static std::atomic<bool> flushRequested(false);
 
-  // hacky... but does the job
-  while ((task = tasks->dequeue()).x != -1) {
-    int x = task.x;
-    int y = task.y;
+static void handleCheckpointSignal(int signal) {
+  if (signal == SIGTERM)
+    terminateRequested = true;
+  else
+    flushRequested = true;
+}
 
-    RGBAColor avgColor(0, 0, 0, 0);
-    int hits = 0;
+bool Scene::progressive() const {
+  return options.timeBudget > 0 || options.writeInterval > 0 || !options.checkpointFile.empty();
+}
 
-    for (int i = 0; i < options.numRays; ++i) {
-      float Sx = getRayScaleX(x + (sampler() - 0.5f) * allowAntiAliasing, width_, height_);
-      float Sy = getRayScaleY(y + (sampler() - 0.5f) * allowAntiAliasing, width_, height_);
+bool Scene::pastDeadline() const {
+  return terminateRequested || (hasDeadline && std::chrono::steady_clock::now() >= deadline);
+}
 
-      RGBAColor color = raytrace(camera.eye, camera.forward + Sx * camera.right + Sy * camera.up, sampler);
-      if (hasNaN(color) == false && color.a != 0) {
-        avgColor += color;
-        ++hits;
+template <typename SampleFunc>
+void Scene::samplePixel(AccumulationBuffer::Pixel &pixel, const RenderTask &task, SampleFunc traceSamples) {
+  if (pastDeadline())
+    return;
+
+  // Samples are keyed by their index, so renders can be resumed, split into tiles or sample ranges,
+  // and spread over any number of threads without changing the result
+  int packetSize = std::max(1, options.packetSize);
+  auto takeSamples = [&](int count) {
+    RGBAColor colors[MAX_PACKET_SIZE];
+    while (count > 0) {
+      int n = std::min(count, packetSize);
+      traceSamples(sampleOffset + pixel.samples, n, colors);
+      for (int i = 0; i < n; ++i) {
+        pixel.add(colors[i]);
       }
+      count -= n;
     }
+  };
 
-    if (hits != 0) {
-      avgColor *= (1.0f/hits);
-      avgColor.a = hits * invNumRays;
-    }
+  takeSamples(task.samples);
+  // Progressive renders refine adaptively by skipping converged pixels between passes
+  if (options.adaptiveThreshold <= 0 || progressive())
+    return;
 
-    img->getPixel(y, x) = clipColor(avgColor);
-    ++finishedPixels;
-    if (finishedPixels % THRESHOLD == 0) {
-      counter->increment(THRESHOLD);
-    }
+  // Spend more samples only where the estimate is still noisy
+  int maxSamples = maxSamplesPerPixel();
+  while (pixel.samples < maxSamples && pixel.error() > options.adaptiveThreshold) {
+    takeSamples(std::min(options.numRays, maxSamples - pixel.samples));
   }
-  counter->increment(finishedPixels % THRESHOLD);
 }
 
-void Scene::threadTaskFisheye(PNG *img, SafeQueue<RenderTask> *tasks, SafeProgressBar *counter) {
+template <typename CameraModel>
+void Scene::threadTask(AccumulationBuffer *film, SafeQueue<RenderTask> *tasks, SafeProgressBar *counter) {
   RenderTask task;
   int finishedPixels = 0;
+  // Counted here and added to the scene's totals once, so threads don't contend on them for every ray
+  uint64_t paths = 0;
+  uint64_t segments = 0;
 
-  float invNumRays = 1.0 / options.numRays;
-  int allowAntiAliasing = std::min(1, options.numRays - 1);
-
-  float invForwardLength = 1.0 / magnitude(camera.forward);
-  Vector3D normalizedForward = normalized(camera.forward);
+  float allowAntiAliasing = std::min(1, maxSamplesPerPixel() - 1);
+  const CameraModel cameraModel(camera, options, width_, height_);
+  std::unique_ptr<Sampler> samplerOwner = makeSampler(options.sampler);
+  Sampler &sampler = *samplerOwner;
+  // Rays of a thin lens start spread across the lens and converge on the focal plane, so the cone is sized for the pinhole camera
+  RayCone cone{ 0.0f, pixelSpread() };
 
-  // Avoid race condiiton
-  Vector3D forwardCopy = camera.forward;
-
-  UniformDistribution sampler(std::mt19937(), std::uniform_real_distribution<float>(0, 1.0));
+  RayPacket<MAX_PACKET_SIZE> packet;
+  int packetSamples[MAX_PACKET_SIZE];
+  IntersectionInfo primaryHits[MAX_PACKET_SIZE];
 
   // hacky... but does the job
   while ((task = tasks->dequeue()).x != -1) {
-    int x = task.x;
-    int y = task.y;
-
-    RGBAColor avgColor(0, 0, 0, 0);
-    int hits = 0;
-
-    for (int i = 0; i < options.numRays; ++i) {
-      float Sx = getRayScaleX(x + (sampler() - 0.5f) * allowAntiAliasing, width_, height_);
-      float Sy = getRayScaleY(y + (sampler() - 0.5f) * allowAntiAliasing, width_, height_);
-
-      Sx *= invForwardLength;
-      Sy *= invForwardLength;
-      float r_2 = Sx * Sx + Sy * Sy;
-      if (r_2 > 1) {
-        continue;
+    float x = task.x;
+    float y = task.y;
+    uint32_t pixelIndex = task.y * width_ + task.x;
+
+    samplePixel(film->getPixel(task.y, task.x), task, [&](uint32_t firstSample, int count, RGBAColor *colors) {
+      // Samples of a pixel start out nearly parallel, so their camera rays go through the BVH as a packet
+      packet.size = 0;
+      for (int i = 0; i < count; ++i) {
+        sampler.startSample(seed, pixelIndex, firstSample + i);
+        float px = x + (sampler() - 0.5f) * allowAntiAliasing;
+        float py = y + (sampler() - 0.5f) * allowAntiAliasing;
+        Vector3D origin;
+        Vector3D direction;
+        colors[i] = RGBAColor(0, 0, 0, 0);
+        if (cameraModel.generateRay(px, py, sampler, origin, direction)) {
+          packetSamples[packet.size] = i;
+          packet.set(packet.size++, origin, direction);
+        }
       }
-      forwardCopy = sqrt(1 - r_2) * normalizedForward;
 
-      RGBAColor color = raytrace(camera.eye, forwardCopy + Sx * camera.right + Sy * camera.up, sampler);
-      if (hasNaN(color) == false && color.a != 0) {
-        avgColor += color;
-        ++hits;
+      if (packet.size > 1)
+        findClosestObjects(packet, primaryHits);
+      for (int lane = 0; lane < packet.size; ++lane) {
+        int i = packetSamples[lane];
+        sampler.startSample(seed, pixelIndex, firstSample + i);
+        Vector3D origin(packet.ox[lane], packet.oy[lane], packet.oz[lane]);
+        Vector3D direction(packet.dx[lane], packet.dy[lane], packet.dz[lane]);
+        colors[i] = raytrace(origin, direction, cone, sampler, segments, (packet.size > 1) ? &primaryHits[lane] : nullptr);
       }
-    }
+      paths += packet.size;
+    });
 
-    if (hits != 0) {
-      avgColor *= (1.0f/hits);
-      avgColor.a = hits * invNumRays;
-    }
-
-    img->getPixel(y, x) = clipColor(avgColor);
     ++finishedPixels;
     if (finishedPixels % THRESHOLD == 0) {
       counter->increment(THRESHOLD);
     }
   }
   counter->increment(finishedPixels % THRESHOLD);
+  cameraRays.fetch_add(paths, std::memory_order_relaxed);
+  pathSegments.fetch_add(segments, std::memory_order_relaxed);
 }
 
-void Scene::threadTaskDOF(PNG *img, SafeQueue<RenderTask> *tasks, SafeProgressBar *counter) {
-  RenderTask task;
+template <typename CameraModel>
+void Scene::threadTaskWavefront(AccumulationBuffer *film, SafeQueue<RenderTask> *tasks, SafeProgressBar *counter) {
   int finishedPixels = 0;
 
-  float invNumRays = 1.0 / options.numRays;
-  int allowAntiAliasing = std::min(1, options.numRays - 1);
-  std::uniform_real_distribution<float> sampleDistribution = std::uniform_real_distribution<float>(0, 1.0);
-  UniformDistribution sampler(std::mt19937(), std::uniform_real_distribution<float>(0, 1.0));
-
-  // hacky... but does the job
-  while ((task = tasks->dequeue()).x != -1) {
-    int x = task.x;
-    int y = task.y;
-
-    RGBAColor avgColor(0, 0, 0, 0);
-    int hits = 0;
-
-    for (int i = 0; i < options.numRays; ++i) {
-      float Sx = getRayScaleX(x + (sampler() - 0.5f) * allowAntiAliasing, width_, height_);
-      float Sy = getRayScaleY(y + (sampler() - 0.5f) * allowAntiAliasing, width_, height_);
-      Vector3D rayDirection = camera.forward + Sx * camera.right + Sy * camera.up;
-      Vector3D intersectionPoint = options.focus / magnitude(rayDirection) * rayDirection + camera.eye;
-      float weight = sampler() * 2 * M_PI;
-      float r = sampler() - 0.5f;
-      Vector3D origin = r * cos(weight) * options.lens / magnitude(camera.right) * camera.right
-                      + r * sin(weight) * options.lens / magnitude(camera.up) * camera.up
-                      + camera.eye;
-      rayDirection = intersectionPoint - origin;
-
-      RGBAColor color = raytrace(origin, rayDirection, sampler);
-      if (hasNaN(color) == false && color.a != 0) {
-        avgColor += color;
-        ++hits;
+  float allowAntiAliasing = std::min(1, maxSamplesPerPixel() - 1);
+  const CameraModel cameraModel(camera, options, width_, height_);
+  std::unique_ptr<Sampler> samplerOwner = makeSampler(options.sampler);
+  Sampler &sampler = *samplerOwner;
+  RayCone cone{ 0.0f, pixelSpread() };
+  Wavefront wavefront(this, sampler);
+  bool adaptive = options.adaptiveThreshold > 0 && !progressive();
+  int maxSamples = maxSamplesPerPixel();
+
+  // Pixels of the batch, and for each of their samples the path tracing it, or -1 if the camera doesn't see it
+  std::vector<RenderTask> batch;
+  std::vector<RenderTask> unfinished;
+  std::vector<int64_t> samplePaths;
+  bool stopped = false;
+  while (!stopped || !batch.empty()) {
+    int batchSamples = 0;
+    for (const RenderTask &task : batch) {
+      batchSamples += task.samples;
+    }
+    while (!stopped && batchSamples < WAVEFRONT_BATCH_SIZE) {
+      RenderTask task = tasks->dequeue();
+      if (task.x == -1) {
+        stopped = true;
+        break;
       }
+      batch.push_back(task);
+      batchSamples += task.samples;
+    }
+    if (pastDeadline()) {
+      finishedPixels += batch.size();
+      batch.clear();
+      continue;
     }
 
-    if (hits != 0) {
-      avgColor *= (1.0f/hits);
-      avgColor.a = hits * invNumRays;
+    wavefront.clear();
+    samplePaths.clear();
+    uint64_t paths = 0;
+    for (const RenderTask &task : batch) {
+      uint32_t pixelIndex = task.y * width_ + task.x;
+      int samples = film->getPixel(task.y, task.x).samples;
+      for (int i = 0; i < task.samples; ++i) {
+        uint32_t sampleIndex = sampleOffset + samples + i;
+        sampler.startSample(seed, pixelIndex, sampleIndex);
+        float px = task.x + (sampler() - 0.5f) * allowAntiAliasing;
+        float py = task.y + (sampler() - 0.5f) * allowAntiAliasing;
+        Vector3D origin;
+        Vector3D direction;
+        if (cameraModel.generateRay(px, py, sampler, origin, direction)) {
+          samplePaths.push_back(wavefront.addCameraRay(pixelIndex, sampleIndex, origin, direction, cone));
+          ++paths;
+        } else {
+          samplePaths.push_back(-1);
+        }
+      }
     }
+    wavefront.trace();
+    cameraRays.fetch_add(paths, std::memory_order_relaxed);
+    pathSegments.fetch_add(wavefront.takeSegments(), std::memory_order_relaxed);
+
+    // Add samples in order like samplePixel, keeping pixels that adaptive sampling isn't done with for the next batch
+    unfinished.clear();
+    size_t sample = 0;
+    for (const RenderTask &task : batch) {
+      AccumulationBuffer::Pixel &pixel = film->getPixel(task.y, task.x);
+      for (int i = 0; i < task.samples; ++i, ++sample) {
+        pixel.add(samplePaths[sample] < 0 ? RGBAColor(0, 0, 0, 0) : wavefront.radianceOf(samplePaths[sample]));
+      }
 
-    img->getPixel(y, x) = clipColor(avgColor);
-    ++finishedPixels;
-    if (finishedPixels % THRESHOLD == 0) {
-      counter->increment(THRESHOLD);
+      if (adaptive && pixel.samples < maxSamples && pixel.error() > options.adaptiveThreshold) {
+        unfinished.push_back({ task.x, task.y, std::min(options.numRays, maxSamples - pixel.samples) });
+        continue;
+      }
+      ++finishedPixels;
+      if (finishedPixels % THRESHOLD == 0) {
+        counter->increment(THRESHOLD);
+      }
     }
+    batch.swap(unfinished);
   }
   counter->increment(finishedPixels % THRESHOLD);
 }
@@ -184,6 +271,102 @@ IntersectionInfo Scene::findAnyObject(const Vector3D& origin, const Vector3D& di
   return closestInfo;
 }
 
+void Scene::findClosestObjects(const RayPacket<MAX_PACKET_SIZE> &packet, IntersectionInfo *infos) const {
+  if (packet.size <= 4) {
+    RayPacket<4> narrow;
+    narrow.size = packet.size;
+    for (int i = 0; i < packet.size; ++i) {
+      narrow.set(i, Vector3D(packet.ox[i], packet.oy[i], packet.oz[i]), Vector3D(packet.dx[i], packet.dy[i], packet.dz[i]));
+    }
+    bvh->findClosestObjects(narrow, infos);
+  } else {
+    bvh->findClosestObjects(packet, infos);
+  }
+
+  for (int i = 0; i < packet.size; ++i) {
+    Vector3D origin(packet.ox[i], packet.oy[i], packet.oz[i]);
+    Vector3D direction(packet.dx[i], packet.dy[i], packet.dz[i]);
+    for (auto it = planes.begin(); it != planes.end(); ++it) {
+      IntersectionInfo info = (*it)->intersect(origin, direction);
+      if (info.t < infos[i].t)
+        infos[i] = info;
+    }
+  }
+}
+
+template <typename ChunkFunc>
+void Scene::forEachChunk(size_t count, int numThreads, ChunkFunc traceChunk) const {
+  size_t numChunks = (count + RAY_BATCH_CHUNK_SIZE - 1) / RAY_BATCH_CHUNK_SIZE;
+  numThreads = std::min<size_t>(std::max(numThreads, 1), numChunks);
+  if (numThreads <= 1) {
+    traceChunk(0, count);
+    return;
+  }
+
+  std::atomic<size_t> next{0};
+  queryPool.run(numThreads, [&]() {
+    size_t begin;
+    while ((begin = next.fetch_add(RAY_BATCH_CHUNK_SIZE, std::memory_order_relaxed)) < count) {
+      traceChunk(begin, std::min(begin + RAY_BATCH_CHUNK_SIZE, count));
+    }
+  });
+}
+
+void Scene::intersect(const RayBatch &rays, HitBatch &hits, int numThreads) const {
+  size_t count = rays.size();
+  hits.resize(count);
+
+  forEachChunk(count, numThreads, [&](size_t begin, size_t end) {
+    RayPacket<MAX_PACKET_SIZE> packet;
+    IntersectionInfo infos[MAX_PACKET_SIZE];
+    for (size_t first = begin; first < end; first += MAX_PACKET_SIZE) {
+      packet.size = std::min<size_t>(MAX_PACKET_SIZE, end - first);
+      bool degenerate[MAX_PACKET_SIZE];
+      for (int lane = 0; lane < packet.size; ++lane) {
+        // Normalized directions put BVH box distances in the same units as hit distances. Zero directions
+        // can't be normalized, so they are traced along an arbitrary axis and reported as misses.
+        Vector3D direction = rays.direction[first + lane];
+        degenerate[lane] = dot(direction, direction) == 0;
+        packet.set(lane, rays.origin[first + lane], degenerate[lane] ? Vector3D(0, 0, 1) : normalized(direction));
+      }
+      findClosestObjects(packet, infos);
+
+      for (int lane = 0; lane < packet.size; ++lane) {
+        size_t i = first + lane;
+        const IntersectionInfo &info = infos[lane];
+        bool hit = !degenerate[lane] && info.obj != nullptr && info.t < rays.maxT[i];
+        hits.t[i] = hit ? info.t : INF_D;
+        hits.point.set(i, info.point);
+        hits.normal.set(i, info.normal);
+        hits.obj[i] = hit ? info.obj : nullptr;
+      }
+    }
+  });
+}
+
+void Scene::occluded(const RayBatch &rays, Bitmask &mask, int numThreads) const {
+  size_t count = rays.size();
+  mask.resize(count);
+
+  forEachChunk(count, numThreads, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      Vector3D origin = rays.origin[i];
+      Vector3D direction = rays.direction[i];
+      if (dot(direction, direction) == 0)
+        continue;
+      direction = normalized(direction);
+      float maxT = rays.maxT[i];
+      bool blocked = bvh->findAnyObject(origin, direction, maxT);
+      for (auto it = planes.begin(); it != planes.end() && !blocked; ++it) {
+        IntersectionInfo info = (*it)->intersect(origin, direction);
+        blocked = info.obj != nullptr && info.t < maxT;
+      }
+      if (blocked)
+        mask.set(i);
+    }
+  });
+}
+
 IntersectionInfo Scene::findClosestObject(const Vector3D& origin, const Vector3D& direction) const {
   IntersectionInfo closestInfo = bvh->findClosestObject(origin, direction);
 
@@ -195,123 +378,480 @@ IntersectionInfo Scene::findClosestObject(const Vector3D& origin, const Vector3D
   return closestInfo;
 }
 
-RGBAColor Scene::illuminate(const IntersectionInfo& info, UniformDistribution &sampler) {
+RGBAColor Scene::illuminate(const IntersectionInfo& info, const Vector3D &wo, const RGBAColor &surfaceColor, Sampler &sampler) {
   RGBAColor L;
 
-  for (auto it = lights.begin(); it != lights.end(); ++it) {
-      L += (*it)->intensity(info.point, info.normal, this, sampler);
+  int numLights = lights.size();
+  uint32_t dimension = sampler.currentDimension();
+  if (lightDistribution.count() == 0) {
+    for (int i = 0; i < numLights; ++i) {
+        sampler.setDimension(dimension + i * LIGHT_DIMENSIONS);
+        L += sampleLight(i, info, wo, sampler);
+    }
+  } else {
+    // Sample a few lights by power and divide by how likely they were to be picked
+    float invLightSamples = 1.0f / options.lightSamples;
+    for (int i = 0; i < options.lightSamples; ++i) {
+      sampler.setDimension(dimension + i * LIGHT_DIMENSIONS);
+      float pmf;
+      int light = lightDistribution.sample(sampler(), &pmf);
+      L += sampleLight(light, info, wo, sampler) * (invLightSamples / pmf);
+    }
   }
 
-  return info.obj->getColor(info.point) * L;
+  return surfaceColor * L;
+}
+
+RGBAColor Scene::sampleLight(int i, const IntersectionInfo& info, const Vector3D &wo, Sampler &sampler) {
+  const Light *light = lights[i];
+  if (light->isDelta())
+    return light->intensity(info.point, info.normal, this, sampler);
+
+  Vector3D wi;
+  float lightPdf;
+  RGBAColor Li = light->sample(info.point, info.normal, sampler, &wi, &lightPdf);
+  if (lightPdf == 0)
+    return RGBAColor(0, 0, 0, 1);
+
+  // Skip the shadow ray when the BSDF doesn't reflect any of the light, e.g. for mirrors and glass
+  const BSDF &bsdf = info.obj->material->bsdf;
+  float f = bsdf.func(wo, wi, info.normal);
+  if (f == 0 || light->pointInShadow(info.point, wi, this))
+    return RGBAColor(0, 0, 0, 1);
+
+  float weight = powerHeuristic(lightSampleCount(i) * lightPdf, bsdf.pdf(wo, wi, info.normal));
+  return Li * (f * std::abs(dot(wi, info.normal)) * weight / lightPdf);
+}
+
+float Scene::lightSampleCount(int i) const {
+  if (lightDistribution.count() == 0)
+    return 1.0f;
+  return options.lightSamples * lightDistribution.pmf(i);
+}
+
+float Scene::pixelSpread() const {
+  // Neighboring pixels are 2 / max(w, h) apart in units of 'right', at a distance of 'forward' from the eye
+  return 2.0f * magnitude(camera.right) / (std::max(width_, height_) * magnitude(camera.forward));
+}
+
+RGBAColor Scene::raytrace(const Vector3D& origin, const Vector3D& direction, RayCone cone, Sampler &sampler, uint64_t &segments, const IntersectionInfo *primaryHit) {
+  PathState path;
+  path.origin = origin;
+  path.direction = direction;
+  path.cone = cone;
+  path.beta = RGBAColor(1, 1, 1, 1);
+  path.isSpecular = true;
+  path.canSplit = options.splitting > 1;
+  path.lastInfo = IntersectionInfo{};
+  path.lastPdf = 0.0f;
+  path.dimensionOffset = 0;
+
+  return tracePath(path, 0, sampler, segments, primaryHit);
+}
+
+uint32_t Scene::bounceDimensions() const {
+  int lightSamplesPerPoint = (lightDistribution.count() == 0) ? lights.size() : options.lightSamples;
+  return BSDF_DIMENSIONS + ROULETTE_DIMENSIONS + LIGHT_DIMENSIONS * lightSamplesPerPoint;
 }
 
-RGBAColor Scene::raytrace(const Vector3D& origin, const Vector3D& direction, UniformDistribution &sampler) {
+RGBAColor Scene::tracePath(PathState path, int firstBounce, Sampler &sampler, uint64_t &segments, const IntersectionInfo *firstHit) {
   RGBAColor L(0,0,0,0);
-  RGBAColor beta(1,1,1,1);
-  // bool isSpecular = false;
-  Vector3D rayOrigin = origin;
-  Vector3D rayDirection = direction;
 
-  for (int bounces = 0; bounces < options.maxBounces; ++bounces) {
-    IntersectionInfo intersectInfo = findClosestObject(rayOrigin, rayDirection);
+  int numLights = lights.size();
+  uint32_t bounceDimensions = this->bounceDimensions();
+  for (int bounces = firstBounce; bounces < options.maxBounces; ++bounces) {
+    uint32_t dimension = CAMERA_DIMENSIONS + path.dimensionOffset + bounces * bounceDimensions;
+    IntersectionInfo intersectInfo = (bounces == firstBounce && firstHit != nullptr) ? *firstHit : findClosestObject(path.origin, path.direction);
+    ++segments;
     if (intersectInfo.obj == nullptr) {
-      // Add environment lighting on miss
-      for (auto it = lights.begin(); it != lights.end(); ++it) {
-        L += (*it)->emittedLight(rayDirection);
+      // Add environment lighting on miss. Camera rays and specular bounces can only see the
+      // environment this way, while rough bounces share it with light sampling at the last hit.
+      for (int i = 0; i < numLights; ++i) {
+        if (path.isSpecular) {
+          L += path.beta * lights[i]->emittedLight(path.direction, path.cone.spread);
+        } else if (!lights[i]->isDelta()) {
+          // Read the unfiltered map like light sampling does, so both strategies estimate the same light
+          RGBAColor Le = lights[i]->emittedLight(path.direction, 0.0f);
+          float lightPdf = lightSampleCount(i) * lights[i]->pdf(path.lastInfo.point, path.lastInfo.normal, path.direction);
+          L += path.beta * path.lastColor * Le * powerHeuristic(path.lastPdf, lightPdf);
+        }
       }
       break;
     }
     
     Vector3D point = intersectInfo.point;
-    Vector3D wo = -normalized(rayDirection);
+    Vector3D wo = -normalized(path.direction);
     Vector3D outNormal = faceForward(wo, intersectInfo.normal);
     intersectInfo.point += options.bias * outNormal;
     const std::shared_ptr<Material> &material = intersectInfo.obj->material;
 
-    L += beta * illuminate(intersectInfo, sampler);
+    // The footprint stretches along the surface at grazing angles
+    path.cone.width += path.cone.spread * magnitude(point - path.origin);
+    float footprint = path.cone.width / std::max(std::abs(dot(wo, intersectInfo.normal)), 0.01f);
+
+    RGBAColor surfaceColor = intersectInfo.obj->getColor(intersectInfo.point, footprint);
+    sampler.setDimension(dimension + BSDF_DIMENSIONS + ROULETTE_DIMENSIONS);
+    L += path.beta * illuminate(intersectInfo, wo, surfaceColor, sampler);
+    // Light sampling is tinted by the surface color, which metals already carry in beta
+    path.lastInfo = intersectInfo;
+    path.lastColor = surfaceColor;
     // Add metallic object specular contribution
-    if (material->type == MaterialType::Metal)
-      beta *= intersectInfo.obj->color;
+    if (material->type == MaterialType::Metal) {
+      path.beta *= intersectInfo.obj->color;
+      path.lastColor = RGBAColor(1, 1, 1, 1);
+    }
+
+    // Split the first rough bounce into more branches the more the path still carries, so indirect light
+    // gets more samples per camera ray where it matters without paying for more camera rays
+    int splits = 1;
+    if (path.canSplit && material->type != MaterialType::Glass && material->type != MaterialType::Mirror) {
+      float throughput = std::max({ path.beta.r, path.beta.g, path.beta.b });
+      splits = std::clamp(static_cast<int>(std::ceil(options.splitting * std::min(throughput, 1.0f))), 1, options.splitting);
+      path.canSplit = false;
+    }
     
-    float pdf = 0.0f;
-    BDFType type{};
-    Vector3D wi;
-    float contribution = material->bsdf.sampleFunc(wo, &wi, intersectInfo.normal, sampler, &pdf, &type);
-    if (pdf == 0 || contribution == 0)
-      break;
+    bool continues = false;
+    for (int branch = splits - 1; branch >= 0; --branch) {
+      // Every branch but the first draws from dimensions past the end of the unsplit path
+      uint32_t branchOffset = branch * options.maxBounces * bounceDimensions;
+      PathState next = path;
+      next.dimensionOffset += branchOffset;
+
+      float pdf = 0.0f;
+      BDFType type{};
+      Vector3D wi;
+      sampler.setDimension(dimension + branchOffset);
+      float contribution = material->bsdf.sampleFunc(wo, &wi, intersectInfo.normal, sampler, &pdf, &type);
+      if (pdf == 0 || contribution == 0)
+        continue;
 
-    beta *= contribution * std::abs(dot(wi, intersectInfo.normal)) / pdf;
-    bool exiting = dot(wi, outNormal) > 0;
-    rayOrigin = point + outNormal * (exiting ? options.bias : -options.bias);
-    rayDirection = wi;
-    // isSpecular = static_cast<bool>(type & BDFType::PERFECT_SPECULAR);
+      next.beta *= contribution * std::abs(dot(wi, intersectInfo.normal)) / pdf;
+      next.lastPdf = pdf;
+      bool exiting = dot(wi, outNormal) > 0;
+      next.origin = point + outNormal * (exiting ? options.bias : -options.bias);
+      next.direction = wi;
+      // Mirrors and glass keep the cone as is, while rough bounces widen it to the solid angle covered by the sampled lobe
+      if (!static_cast<bool>(type & BDFType::PERFECT_SPECULAR))
+        next.cone.spread += 2.0f * std::sqrt(1.0f / (M_PI * pdf));
+      next.isSpecular = static_cast<bool>(type & BDFType::PERFECT_SPECULAR);
+
+      // Russian roulette: paths that carry little light are ended early, and the ones that survive are
+      // weighted up by the same amount so the estimate stays unbiased
+      if (bounces + 1 >= options.rouletteDepth && bounces + 1 < options.maxBounces) {
+        float survival = std::min(std::max({ next.beta.r, next.beta.g, next.beta.b }), 1.0f);
+        if (survival < 1.0f) {
+          sampler.setDimension(dimension + BSDF_DIMENSIONS + branchOffset);
+          if (sampler() >= survival)
+            continue;
+          next.beta = next.beta / survival;
+        }
+      }
+      next.beta = next.beta / splits;
+
+      if (branch == 0) {
+        path = next;
+        continues = true;
+      } else {
+        L += tracePath(next, bounces + 1, sampler, segments);
+      }
+    }
+    if (!continues)
+      break;
   }
   
   return L;
 }
 
-PNG *Scene::render(std::function<void (Scene *, PNG *, SafeQueue<RenderTask> *, SafeProgressBar *)> worker, int numThreads) {
-  Profiler p(Funcs::Render);
+int Scene::renderPass(const RenderWorker &worker, int numThreads, AccumulationBuffer &film, int samples, const Tile &region, bool showProgress) {
+  int maxSamples = std::min(samples, maxSamplesPerPixel());
+  bool skipConverged = progressive() && options.adaptiveThreshold > 0;
 
-  int totalPixels = height_ * width_;
-  int update = std::max(4096.0, 0.01 * totalPixels);
+  std::vector<RenderTask> pixels;
+  for (int y = region.y0; y < region.y1; ++y) {
+    for (int x = region.x0; x < region.x1; ++x) {
+      const AccumulationBuffer::Pixel &pixel = film.getPixel(y, x);
+      if (pixel.samples >= maxSamples)
+        continue;
+      if (skipConverged && pixel.samples >= options.numRays && pixel.error() <= options.adaptiveThreshold)
+        continue;
+      pixels.push_back({ x, y, maxSamples - pixel.samples });
+    }
+  }
+  if (pixels.empty())
+    return 0;
 
-  PNG *img = new PNG(width_, height_);
+  int totalPixels = pixels.size();
+  int update = std::max(4096.0, 0.01 * totalPixels);
 
   SafeQueue<RenderTask> tasks;
-  SafeProgressBar counter(70, totalPixels, update);
+  SafeProgressBar counter(70, totalPixels, update, showProgress);
 
   std::vector<std::thread> threads;
   for (int i = 0; i < numThreads; ++i) {
-    threads.emplace_back(worker, this, img, &tasks, &counter);
+    threads.emplace_back(worker, this, &film, &tasks, &counter);
   }
-  
-  for (int y = 0; y < height_; ++y) {
-    for (int x = 0; x < width_; ++x) {
-      tasks.enqueue({ x, y });
-    }
+
+  for (const RenderTask &task : pixels) {
+    tasks.enqueue(task);
   }
   for (int i = 0; i < numThreads; ++i) {
-    tasks.enqueue({ -1, -1 });
+    tasks.enqueue({ -1, -1, 0 });
   }
   for (size_t i = 0; i < threads.size(); ++i) {
     threads[i].join();
   }
+  return totalPixels;
+}
+
+void Scene::renderProgressive(const RenderWorker &worker, int numThreads, AccumulationBuffer &film) {
+  using Clock = std::chrono::steady_clock;
+  auto secondsSince = [](Clock::time_point t) {
+    return std::chrono::duration<double>(Clock::now() - t).count();
+  };
+
+  bool checkpointing = !options.checkpointFile.empty();
+  if (checkpointing) {
+    terminateRequested = false;
+    flushRequested = false;
+    std::signal(SIGTERM, handleCheckpointSignal);
+    std::signal(SIGUSR1, handleCheckpointSignal);
+  }
 
-  if (options.exposure >= 0)
-    expose(img);
-  
-  return img;
+  Clock::time_point start = Clock::now();
+  Clock::time_point lastWrite = start;
+  deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.timeBudget));
+  // The first pass always finishes so that every pixel has a sample
+  int samplesPerPixel = film.minSamples();
+  hasDeadline = options.timeBudget > 0 && samplesPerPixel > 0;
+
+  int target = maxSamplesPerPixel();
+  int passRays = 1;
+  int pass = 0;
+  while (samplesPerPixel < target) {
+    passRays = std::min(passRays, target - samplesPerPixel);
+    Clock::time_point passStart = Clock::now();
+    int sampledPixels = renderPass(worker, numThreads, film, samplesPerPixel + passRays, { 0, 0, width_, height_ });
+    double passSeconds = secondsSince(passStart);
+    bool outOfTime = options.timeBudget > 0 && Clock::now() >= deadline;
+    hasDeadline = options.timeBudget > 0;
+    if (sampledPixels == 0)
+      break;
+
+    samplesPerPixel += passRays;
+    ++pass;
+    std::cout << "Pass " << pass << ": " << std::fixed << std::setprecision(2) << film.averageSamples()
+              << " samples per pixel after " << secondsSince(start) << " sec." << std::endl;
+
+    if (terminateRequested) {
+      std::cout << "Stopping early after SIGTERM." << std::endl;
+      break;
+    }
+    if (outOfTime) {
+      std::cout << "Time budget of " << options.timeBudget << " sec reached." << std::endl;
+      break;
+    }
+    bool writeDue = options.writeInterval > 0 && secondsSince(lastWrite) >= options.writeInterval;
+    if (writeDue && samplesPerPixel < target) {
+      PNG *img = film.resolve();
+      img->saveToFile(filename_);
+      delete img;
+      lastWrite = Clock::now();
+    }
+    // Without a write interval the accumulation file is flushed after every pass
+    if (checkpointing && (writeDue || options.writeInterval <= 0 || flushRequested.exchange(false)))
+      film.saveToFile(options.checkpointFile);
+
+    // Double the samples each pass, but keep passes short enough to write on time and to fit in the remaining
+    // budget so the last pass doesn't leave part of the image with fewer samples than the rest
+    double secondsPerRay = std::max(passSeconds / passRays, 1e-6);
+    passRays = samplesPerPixel;
+    if (options.writeInterval > 0)
+      passRays = std::min(passRays, std::max(1, static_cast<int>(options.writeInterval / secondsPerRay)));
+    if (options.timeBudget > 0) {
+      double remaining = std::chrono::duration<double>(deadline - Clock::now()).count();
+      passRays = std::min(passRays, std::max(1, static_cast<int>(remaining / secondsPerRay)));
+    }
+  }
+  hasDeadline = false;
+
+  if (checkpointing) {
+    if (film.saveToFile(options.checkpointFile))
+      std::cout << "Saved accumulation file " << options.checkpointFile << "." << std::endl;
+    std::signal(SIGTERM, SIG_DFL);
+    std::signal(SIGUSR1, SIG_DFL);
+  }
+  std::cout << "Progressive render took " << pass << " passes." << std::endl;
+}
+
+PNG *Scene::render(const RenderWorker &worker, int numThreads) {
+  Profiler p(Funcs::Render);
+
+  AccumulationBuffer film(width_, height_);
+  film.seed = seed;
+  film.sampleOffset = options.sampleOffset;
+  if (options.resume) {
+    if (!film.readFromFile(options.checkpointFile))
+      return nullptr;
+    if (film.width() != width_ || film.height() != height_) {
+      std::cerr << "Accumulation file " << options.checkpointFile << " is " << film.width() << 'x' << film.height()
+                << " but the scene renders at " << width_ << 'x' << height_ << "." << std::endl;
+      return nullptr;
+    }
+    std::cout << "Resuming from " << options.checkpointFile << " with " << std::fixed << std::setprecision(2)
+              << film.averageSamples() << " samples per pixel." << std::endl;
+  }
+  // Resumed renders continue the random sequences of the accumulation file
+  seed = film.seed;
+  sampleOffset = film.sampleOffset;
+  film.exposure = options.exposure;
+
+  if (progressive())
+    renderProgressive(worker, numThreads, film);
+  else
+    renderPass(worker, numThreads, film, options.numRays, { 0, 0, width_, height_ });
+
+  if (options.adaptiveThreshold > 0)
+    reportSampleCounts(film);
+  reportPathLengths();
+
+  return film.resolve();
+}
+
+RenderWorker Scene::selectWorker() const {
+  if (options.integrator == IntegratorType::Wavefront) {
+    if (options.fisheye)
+      return &Scene::threadTaskWavefront<FisheyeCamera>;
+    if (options.focus > 0)
+      return &Scene::threadTaskWavefront<ThinLensCamera>;
+    return &Scene::threadTaskWavefront<PinholeCamera>;
+  }
+  if (options.fisheye)
+    return &Scene::threadTask<FisheyeCamera>;
+  if (options.focus > 0)
+    return &Scene::threadTask<ThinLensCamera>;
+  return &Scene::threadTask<PinholeCamera>;
+}
+
+bool Scene::prepare(int numThreads, int seed) {
+  this->seed = seed;
+  return finishLoading(numThreads);
+}
+
+void Scene::renderTile(AccumulationBuffer &film, const Tile &tile, int numThreads) {
+  seed = film.seed;
+  sampleOffset = film.sampleOffset;
+  renderPass(selectWorker(), numThreads, film, options.numRays, tile, false);
 }
 
 PNG *Scene::render(int numThreads, int seed) {
-  bvh = std::make_unique<BVH>(objects, numThreads);
+  if (!prepare(numThreads, seed))
+    return nullptr;
 
   if (options.fisheye) {
     std::cout << "Fisheye enabled." << std::endl;
-    return render(&Scene::threadTaskFisheye, numThreads);
   } else if (options.focus > 0) {
     std::cout << "Depth of Field enabled." << std::endl;
-    return render(&Scene::threadTaskDOF, numThreads);
   } else {
     std::cout << "Default render." << std::endl;
-    return render(&Scene::threadTaskDefault, numThreads);
   }
+  return render(selectWorker(), numThreads);
 }
 
+void Scene::reportPathLengths() {
+  uint64_t paths = cameraRays.exchange(0);
+  uint64_t segments = pathSegments.exchange(0);
+  if (paths == 0)
+    return;
+
+  std::cout << "Paths traced " << std::fixed << std::setprecision(2) << static_cast<double>(segments) / paths
+            << " rays per camera ray on average";
+  if (options.rouletteDepth < options.maxBounces)
+    std::cout << " with Russian roulette after " << options.rouletteDepth << " bounces";
+  std::cout << "." << std::endl;
+}
+
+void Scene::reportSampleCounts(const AccumulationBuffer &film) const {
+  std::cout << "Adaptive sampling took " << std::fixed << std::setprecision(2)
+            << film.averageSamples() << " samples per pixel on average ("
+            << film.minSamples() << " min, " << film.maxSamples() << " max)." << std::endl;
+
+  if (!options.sampleMap.empty()) {
+    PNG *map = film.sampleMap(maxSamplesPerPixel());
+    map->saveToFile(options.sampleMap);
+    delete map;
+  }
+}
 
-void Scene::expose(PNG *img) {
-  for (int y = 0; y < height_; ++y) {
-    for (int x = 0; x < width_; ++x) {
-        RGBAColor &pixel = img->getPixel(y, x);
-        pixel.r = exponentialExposure(pixel.r, options.exposure);
-        pixel.g = exponentialExposure(pixel.g, options.exposure);
-        pixel.b = exponentialExposure(pixel.b, options.exposure);
+bool Scene::finishLoading(int numThreads) {
+  Profiler p(Funcs::AssetLoading);
+
+  // Objects added directly by the parser are built while the meshes are still loading
+  std::vector<std::unique_ptr<BVH>> subtrees;
+  subtrees.push_back(std::make_unique<BVH>(objects, numThreads));
+
+  // Every task is waited on even after one fails, since they write into the scene
+  bool loaded = true;
+  for (std::future<std::unique_ptr<Mesh>> &future : meshes) {
+    std::unique_ptr<Mesh> mesh;
+    try {
+      mesh = future.get();
+    } catch (const std::exception &e) {
+      std::cerr << "Failed to load a mesh: " << e.what() << std::endl;
+      loaded = false;
     }
+    if (mesh == nullptr)
+      continue;
+    arena.adopt(mesh->arena);
+    for (ArenaPtr<Object> &obj : mesh->objects) {
+      addObject(std::move(obj));
+    }
+    subtrees.push_back(std::move(mesh->bvh));
+  }
+  meshes.clear();
+
+  for (std::shared_future<void> &task : loadTasks) {
+    try {
+      task.get();
+    } catch (const std::exception &e) {
+      std::cerr << "Failed to load a texture: " << e.what() << std::endl;
+      loaded = false;
+    }
+  }
+  loadTasks.clear();
+  if (!loaded)
+    return false;
+
+  for (EnvironmentLight *light : worldCenteredLights) {
+    light->center = worldCenter();
+    light->buildDistribution();
+  }
+  worldCenteredLights.clear();
+
+  bvh = (subtrees.size() == 1) ? std::move(subtrees[0]) : std::make_unique<BVH>(objects, subtrees);
+  bvh->layout(options.bvhLayout);
+  if (options.quantizeBVH)
+    bvh->quantize();
+
+  int numLights = lights.size();
+  if (options.lightSamples > 0 && numLights > options.lightSamples) {
+    Box bounds = bvh->bounds();
+    float sceneRadius = objects.empty() ? 1.0f : std::max(1.0f, 0.5f * magnitude(bounds.maxPoint - bounds.minPoint));
+    std::vector<float> powers;
+    for (const Light *light : lights) {
+      powers.push_back(light->power(sceneRadius));
+    }
+    lightDistribution = AliasTable(powers.data(), numLights);
+    std::cout << "Sampling " << options.lightSamples << " of " << numLights << " lights per shading point." << std::endl;
   }
+  return true;
 }
 
-void Scene::addObject(std::unique_ptr<Object> obj) {
+bool Scene::addObject(ArenaPtr<Object> obj) {
+  if (PrimitiveTypes::typeOf(*obj) < 0) {
+    std::cerr << "Skipping an object of a type the BVH can't store." << std::endl;
+    return false;
+  }
   centroidSum += obj->centroid;
   objects.push_back(std::move(obj));
+  return true;
 }
\ No newline at end of file
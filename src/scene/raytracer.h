@@ -2,19 +2,34 @@
 
 #include "Object.h"
 #include "Camera.h"
+#include "RayBatch.h"
 
 #include "../macros.h"
 #include "../image/PNG.h"
+#include "../image/AccumulationBuffer.h"
 #include "../vector/vector3d.h"
+#include "../acceleration/Arena.h"
 #include "../acceleration/BVH.h"
+#include "../acceleration/BVHLayout.h"
+#include "../acceleration/RayPacket.h"
 #include "../acceleration/SafeQueue.h"
 #include "../acceleration/SafeProgressBar.h"
+#include "../acceleration/WorkerPool.h"
 #include "../bsdf/math_utils.h"
+#include "../bsdf/Distribution.h"
 
 // A ray has origin 'eye' and direction 'forward' + Sx * 'right' + Sy * 'up'
 float getRayScaleX(float x, int w, int h);
 float getRayScaleY(float y, int w, int h);
 
+// Sampler dimensions: the camera takes 4 for pixel jitter and the lens, then every bounce takes 4 for
+// sampling the BSDF, 4 for Russian roulette (only the first is used, the rest keep Sobol groups aligned)
+// and 4 for each light sample
+#define CAMERA_DIMENSIONS 4
+#define BSDF_DIMENSIONS 4
+#define ROULETTE_DIMENSIONS 4
+#define LIGHT_DIMENSIONS 4
+
 struct IntersectionInfo;
 class Object;
 class Triangle;
@@ -25,10 +40,59 @@ class DistantLight;
 class PointLight;
 class EnvironmentLight;
 class BVH;
+struct PathState;
 
+/**
+ * RenderTask struct
+ *
+ * x, y    - pixel to sample, or -1 to stop the worker
+ * samples - number of samples to take
+*/
 struct RenderTask {
   int x;
   int y;
+  int samples;
+};
+
+/**
+ * Tile struct
+ *
+ * Rectangle of pixels [x0, x1) x [y0, y1) of the image.
+*/
+struct Tile {
+  int x0;
+  int y0;
+  int x1;
+  int y1;
+};
+
+/**
+ * RayCone struct
+ *
+ * Tracks the footprint of a ray as a cone so texture lookups can pick a mip level.
+ *
+ * width  - width of the cone at the current ray origin
+ * spread - angle the cone widens by per unit distance travelled
+*/
+struct RayCone {
+  float width;
+  float spread;
+};
+
+/**
+ * Mesh - objects loaded from a single asset along with the BVH built over them.
+ * Meshes are produced by background loading tasks and spliced into the scene BVH before rendering.
+ * Objects are allocated from the mesh's own arena, which the scene adopts along with them.
+*/
+struct Mesh {
+  Arena arena;
+  std::vector<ArenaPtr<Object>> objects;
+  std::unique_ptr<BVH> bvh;
+};
+
+enum class IntegratorType {
+  Path,
+  Wavefront
 };
 
 struct SceneOptions {
@@ -39,19 +103,86 @@ struct SceneOptions {
   bool  fisheye    = false;
   float focus      = -1;
   float lens       = 0;
+  int   lightSamples = 4;
+  float adaptiveThreshold = -1;
+  int   maxRays    = 1024;
+  std::string sampleMap;
+  float timeBudget = -1;
+  float writeInterval = -1;
+  std::string checkpointFile;
+  bool  resume     = false;
+  int   sampleOffset = 0;
+  SamplerType sampler = SamplerType::Sobol;
+  int   rouletteDepth = std::numeric_limits<int>::max();
+  int   splitting  = 1;
+  IntegratorType integrator = IntegratorType::Path;
+  bool  sortRays   = true;
+  bool  sortHits   = true;
+  int   packetSize = 1;
+  bool  quantizeBVH = false;
+  BVHLayout bvhLayout = BVHLayout::DepthFirst;
 };
 
+class Scene;
+using RenderWorker = std::function<void (Scene *, AccumulationBuffer *, SafeQueue<RenderTask> *, SafeProgressBar *)>;
+
 class Scene {
+  friend class Wavefront;
+
 public:
   Scene() {};
   Scene(int w, int h, const std::string& file)
     : width_(w), height_(h), filename_(file) {};
   ~Scene();
+  /**
+   * render - renders the scene, or returns nullptr if an asset fails to load or the accumulation file to
+   * resume from can't be used.
+  */
   PNG *render(int numThreads=4, int seed=56);
+  /**
+   * prepare - finishes loading the scene and sets the seed samples are drawn with.
+   * render calls this itself, it is only needed before renderTile. Returns false if an asset failed to load.
+  */
+  bool prepare(int numThreads=4, int seed=56);
+  /**
+   * renderTile
+   * 
+   * Takes options.numRays samples (or adaptively more) at every pixel of tile in film, which covers the
+   * whole image. Pixels get the same samples as in a full render with the film's seed and sample offset.
+  */
+  void renderTile(AccumulationBuffer &film, const Tile &tile, int numThreads);
   IntersectionInfo findClosestObject(const Vector3D& origin, const Vector3D& direction) const;
   IntersectionInfo findAnyObject(const Vector3D& origin, const Vector3D& direction) const;
+  /**
+   * findClosestObjects - findClosestObject for every ray of packet, traced through the BVH together.
+  */
+  void findClosestObjects(const RayPacket<MAX_PACKET_SIZE> &packet, IntersectionInfo *infos) const;
+  /**
+   * intersect
+   * 
+   * Closest hit of every ray of rays before its maxT, written to hits in the same order. Rays are split
+   * into chunks traced on numThreads threads of a pool the scene keeps between calls, consecutive rays
+   * going through the BVH as packets, so callers with many queries should issue them in one batch,
+   * ordered so neighbouring rays are alike. Rays with a zero direction miss. Call prepare first.
+  */
+  void intersect(const RayBatch &rays, HitBatch &hits, int numThreads=std::thread::hardware_concurrency()) const;
+  /**
+   * occluded - sets bit i of mask if ray i of rays hits anything before its maxT, split like intersect.
+   * Rays with a zero direction are never occluded.
+  */
+  void occluded(const RayBatch &rays, Bitmask &mask, int numThreads=std::thread::hardware_concurrency()) const;
+
+  /**
+   * addObject - adds obj to the scene unless it isn't one of the PrimitiveTypes, returning whether it was added.
+  */
+  bool addObject(ArenaPtr<Object> obj);
 
-  void addObject(std::unique_ptr<Object> obj);
+  /**
+   * objectArena - memory for objects added to the scene, freed with the scene. Only used by the parsing thread.
+  */
+  Arena &objectArena() {
+    return arena;
+  }
 
   void addPlane(std::unique_ptr<Plane> plane) {
     planes.push_back(std::move(plane));
@@ -61,6 +192,21 @@ public:
     lights.push_back(light);
   }
 
+  void addMesh(std::future<std::unique_ptr<Mesh>> mesh) {
+    meshes.push_back(std::move(mesh));
+  }
+
+  void addLoadTask(std::shared_future<void> task) {
+    loadTasks.push_back(task);
+  }
+
+  /**
+   * centerOnWorld - moves light to the world center once every mesh has finished loading.
+  */
+  void centerOnWorld(EnvironmentLight *light) {
+    worldCenteredLights.push_back(light);
+  }
+
   void setFilename(const std::string& fname) {
     filename_ = fname;
   }
@@ -93,23 +239,146 @@ public:
   SceneOptions options;
 
 private:
-  RGBAColor illuminate(const IntersectionInfo& info, UniformDistribution &sampler);
-  RGBAColor raytrace(const Vector3D& origin, const Vector3D& direction, UniformDistribution &sampler);
-  void expose(PNG *img);
+  RGBAColor illuminate(const IntersectionInfo& info, const Vector3D &wo, const RGBAColor &surfaceColor, Sampler &sampler);
+  /**
+   * sampleLight
+   * 
+   * Light arriving at info.point from lights[i]. Delta lights use Light::intensity, other lights are
+   * sampled with the surface BSDF applied and weighted against BSDF sampling with the power heuristic.
+  */
+  RGBAColor sampleLight(int i, const IntersectionInfo& info, const Vector3D &wo, Sampler &sampler);
+  /**
+   * lightSampleCount - expected number of light samples taken from lights[i] at each shading point.
+  */
+  float lightSampleCount(int i) const;
+  /**
+   * raytrace - light arriving along a camera ray, starting from primaryHit when its closest hit is already known.
+   * Adds the number of rays traced to segments.
+  */
+  RGBAColor raytrace(const Vector3D& origin, const Vector3D& direction, RayCone cone, Sampler &sampler, uint64_t &segments, const IntersectionInfo *primaryHit=nullptr);
+  /**
+   * tracePath
+   * 
+   * Light carried back along path from bounce firstBounce on. After options.rouletteDepth bounces paths
+   * survive with probability equal to their throughput, and the first rough bounce of a path is split
+   * into up to options.splitting branches. Adds the number of rays traced to segments. firstHit, when
+   * given, is the closest hit of the path's next ray.
+  */
+  RGBAColor tracePath(PathState path, int firstBounce, Sampler &sampler, uint64_t &segments, const IntersectionInfo *firstHit=nullptr);
+  /**
+   * bounceDimensions - sampler dimensions taken by every bounce of a path.
+  */
+  uint32_t bounceDimensions() const;
+  /**
+   * reportPathLengths - prints the average number of rays traced per camera ray since the last report.
+  */
+  void reportPathLengths();
+  /**
+   * pixelSpread - angle subtended by a single pixel of the camera.
+  */
+  float pixelSpread() const;
+  /**
+   * reportSampleCounts - prints how many samples adaptive sampling took and writes the sample map if requested.
+  */
+  void reportSampleCounts(const AccumulationBuffer &film) const;
+  /**
+   * forEachChunk - calls traceChunk(begin, end) for every chunk of [0, count) on numThreads threads of queryPool.
+  */
+  template <typename ChunkFunc>
+  void forEachChunk(size_t count, int numThreads, ChunkFunc traceChunk) const;
+  /**
+   * finishLoading - waits on background loading tasks and builds the scene BVH from the mesh BVHs.
+   * Returns false, after reporting it, if a loading task failed.
+  */
+  bool finishLoading(int numThreads);
+  /**
+   * threadTask
+   * 
+   * Worker function for threads, sampling the pixels of tasks until it dequeues a stop task. Compiled
+   * once per camera model (see CameraModels.h) so ray generation is inlined into the sampling loop.
+  */
+  template <typename CameraModel>
+  void threadTask(AccumulationBuffer *film, SafeQueue<RenderTask> *tasks, SafeProgressBar *counter);
+  /**
+   * threadTaskWavefront
+   * 
+   * Worker function for the wavefront integrator. Gathers tasks into batches of about WAVEFRONT_BATCH_SIZE
+   * camera rays and traces each batch with a Wavefront, which gives the same samples as threadTask.
+  */
+  template <typename CameraModel>
+  void threadTaskWavefront(AccumulationBuffer *film, SafeQueue<RenderTask> *tasks, SafeProgressBar *counter);
+  PNG *render(const RenderWorker &worker, int numThreads);
+  /**
+   * selectWorker - worker function for the camera set up by the options.
+  */
+  RenderWorker selectWorker() const;
+  /**
+   * renderPass
+   * 
+   * Runs worker on numThreads threads to bring every pixel of region up to samples samples, capped at
+   * maxSamplesPerPixel(), skipping pixels that have converged in progressive renders. Returns the number
+   * of pixels sampled.
+  */
+  int renderPass(const RenderWorker &worker, int numThreads, AccumulationBuffer &film, int samples, const Tile &region, bool showProgress=true);
+  /**
+   * renderProgressive
+   * 
+   * Renders whole passes of doubling sample counts until maxSamplesPerPixel() or options.timeBudget is
+   * reached, writing the current image every options.writeInterval seconds. Every pass after the first
+   * stops sampling at the deadline, so the image always has at least one full pass.
+   * 
+   * With options.checkpointFile set, the accumulation file is flushed on the write interval (or after every
+   * pass without one), at the end of the pass when SIGUSR1 arrives, and before stopping on SIGTERM.
+  */
+  void renderProgressive(const RenderWorker &worker, int numThreads, AccumulationBuffer &film);
+  /**
+   * progressive - whether the render is split into passes by a time budget or write interval.
+  */
+  bool progressive() const;
+  /**
+   * pastDeadline - whether workers should stop taking samples because the time budget ran out.
+  */
+  bool pastDeadline() const;
   /**
-   * threadTaskDefault - default worker function for threads.
+   * samplePixel
+   * 
+   * Takes task.samples samples of a pixel, or none once the time budget has run out. With adaptive sampling
+   * outside of progressive renders, keeps taking batches of options.numRays samples until the pixel's
+   * error is below options.adaptiveThreshold or it has options.maxRays samples.
+   * 
+   * pixel        - accumulated samples of the pixel
+   * task         - pixel coordinates and number of samples to take
+   * traceSamples - called as traceSamples(firstSample, count, colors) with count at most options.packetSize,
+   *                filling colors with the samples of index firstSample onwards
   */
-  void threadTaskDefault(PNG *img, SafeQueue<RenderTask> *tasks, SafeProgressBar *counter);
+  template <typename SampleFunc>
+  void samplePixel(AccumulationBuffer::Pixel &pixel, const RenderTask &task, SampleFunc traceSamples);
   /**
-   * threadTaskFisheye - fisheye render worker function for threads.
+   * maxSamplesPerPixel - the most samples any pixel can receive with the current options.
   */
-  void threadTaskFisheye(PNG *img, SafeQueue<RenderTask> *tasks, SafeProgressBar *counter);
-  void threadTaskDOF(PNG *img, SafeQueue<RenderTask> *tasks, SafeProgressBar *counter);
-  PNG *render(std::function<void (Scene *, PNG *, SafeQueue<RenderTask> *, SafeProgressBar *)> worker, int numThreads);
+  int maxSamplesPerPixel() const;
 
-  std::vector<std::unique_ptr<Object>> objects;
+  // Declared before objects so they are destroyed before their memory is freed
+  Arena arena;
+  std::vector<ArenaPtr<Object>> objects;
   std::vector<std::unique_ptr<Plane>> planes;
   std::vector<Light*> lights;
+  std::vector<std::future<std::unique_ptr<Mesh>>> meshes;
+  std::vector<std::shared_future<void>> loadTasks;
+  std::vector<EnvironmentLight*> worldCenteredLights;
+  // Picks lights proportional to their power when there are more lights than options.lightSamples
+  AliasTable lightDistribution;
+  // Progressive passes stop sampling once deadline passes while hasDeadline is set
+  std::chrono::steady_clock::time_point deadline;
+  bool hasDeadline = false;
+  // Samples are keyed by seed, pixel and sampleOffset plus the pixel's sample count
+  uint32_t seed = 0;
+  int sampleOffset = 0;
+  // Rays traced by every camera ray since the last reportPathLengths, summed over the workers
+  std::atomic<uint64_t> cameraRays{0};
+  std::atomic<uint64_t> pathSegments{0};
+  // Threads intersect and occluded trace on, kept between calls
+  mutable WorkerPool queryPool;
   
   int width_;
   int height_;
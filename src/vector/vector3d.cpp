@@ -155,3 +155,15 @@ std::ostream& operator<<(std::ostream& out, const Vector3D& v) {
   out << '<' << v.x << ", " << v.y << ", " << v.z << '>';
   return out;
 }
+
+void Vector3DArray::gather(const Vector3DArray &other, const std::vector<uint32_t> &indices) {
+  size_t n = indices.size();
+  x.resize(n);
+  y.resize(n);
+  z.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    x[i] = other.x[indices[i]];
+    y[i] = other.y[indices[i]];
+    z[i] = other.z[indices[i]];
+  }
+}
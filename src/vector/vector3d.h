@@ -45,3 +45,49 @@ public:
 };
 
 std::ostream& operator<<(std::ostream& out, const Vector3D& v);
+
+/**
+ * Vector3DArray - x, y and z components of many vectors, each kept in its own array.
+*/
+struct Vector3DArray {
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> z;
+
+  Vector3D operator[](size_t i) const {
+    return Vector3D(x[i], y[i], z[i]);
+  }
+
+  void set(size_t i, const Vector3D &v) {
+    x[i] = v.x;
+    y[i] = v.y;
+    z[i] = v.z;
+  }
+
+  void push_back(const Vector3D &v) {
+    x.push_back(v.x);
+    y.push_back(v.y);
+    z.push_back(v.z);
+  }
+
+  size_t size() const {
+    return x.size();
+  }
+
+  void resize(size_t n) {
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+  }
+
+  void clear() {
+    x.clear();
+    y.clear();
+    z.clear();
+  }
+
+  /**
+   * gather - replaces the contents with the entries of other at indices, in that order.
+  */
+  void gather(const Vector3DArray &other, const std::vector<uint32_t> &indices);
+};